@@ -0,0 +1,360 @@
+// tc 上的快速路径：UA 完整地在一个包中的常见情况，直接在 eBPF 中修改，不经过 netfilter 钩子和 rkpManager 的锁。
+// 挂在 LAN 一侧接口的 clsact ingress 上。不挂在 WAN 的 egress 上，是因为包到那里时 netfilter 的钩子已经执行过，没有办法再交给模块，源地址也已经被 SNAT 改掉了。
+// 一个包中处理不完的（UA 跨越了多个包，或者太长），给这个包打上 mark_capture 交给模块处理，并且记下这个流，之后这个流的所有包都交给模块。
+// 因此模块需要以 autocapture=0 加载，服务端发回的包仍然按照 doc/useage.md 中的示例用 iptables 打上 mark_capture 和 mark_ack。
+// 与模块一样，按 rkpSetting_capture 的 autocapture 规则选择包：从 192.168.0.0/16 发往其它地址的 80 端口的 TCP 包。
+// 每个包独立地扫描，不记录流的扫描进度。匹配的方式与模块相同：名称在一行的开头（\r\n 之后）、不区分大小写，跳过 UA 开头的空白，只修改第一个 UA。
+// 只处理恰好是一个完整的头部的包，即以请求行开头、以 headEnd 结尾，不能确定的都交给模块：
+//      * 没有 UA 或者 UA 为空：放行
+//      * 找到了完整的 UA：就地修改，修正校验和，放行
+//      * 不以请求行开头、头部不完整、头部之后还有数据、有 Content-Length 或 Transfer-Encoding、UA 太长、包太长扫描不完：交给模块
+// 不支持 str_preserve 和 str_rule，使用它们时不要加载这个程序。
+#include <linux/bpf.h>
+#include <linux/pkt_cls.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/in.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#ifndef RKP_UA
+#define RKP_UA "RKP/99.0"                       // 与模块的 str_uaRkp 相同
+#endif
+#ifndef RKP_MARK_CAPTURE
+#define RKP_MARK_CAPTURE 0x100                  // 与模块参数 mark_capture 相同
+#endif
+#define RKP_SCAN_MAX 2048                       // 每个包最多扫描这么多字节的应用层数据，更长的交给模块
+#define RKP_SCAN_CHUNK 64                       // 每次从包中读出这么多字节扫描，RKP_SCAN_MAX 要是它的整数倍
+#define RKP_UA_MAX 248                          // UA 最长多少字节，更长的交给模块。加 8 以后是 2 的幂，用来给下标做掩码
+
+struct rkpBpf_flow
+{
+    __u32 saddr, daddr;
+    __u16 sport, dport;
+};
+
+// 已经交给模块的流。LRU 淘汰一个还在进行中的流的话，模块会等不到后面的包，只能等超时，所以要留足够的空间
+struct
+{
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, struct rkpBpf_flow);
+    __type(value, __u8);
+} rkpBpf_punted SEC(".maps");
+
+enum
+{
+    rkpBpf_stat_rewritten,                      // 在这里修改了 UA 的包
+    rkpBpf_stat_passed,                         // 没有 UA 或者 UA 为空、原样放行的包
+    rkpBpf_stat_punted,                         // 交给模块的流
+    rkpBpf_stat_punted_packets,                 // 交给模块的包
+    rkpBpf_stat_n
+};
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, rkpBpf_stat_n);
+    __type(key, __u32);
+    __type(value, __u64);
+} rkpBpf_stat SEC(".maps");
+
+// 修改时用到的缓冲区，栈上放不下
+struct rkpBpf_buff
+{
+    __u8 from[RKP_UA_MAX + 8], to[RKP_UA_MAX + 8];
+};
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct rkpBpf_buff);
+} rkpBpf_buff SEC(".maps");
+
+// 扫描的进度。扫描的循环中这些值都从 map 中读写，验证器不知道它们的值，也就不会按它们的每一种取值分别验证
+struct rkpBpf_state
+{
+    __u32 method;                               // 请求行开头的方法已经读了几个字母，读完方法和后面的空格以后为 rkpBpf_method_done
+    __u32 crlf;                                 // "\r\n\r\n" 匹配了几个字节，为 2 时在一行的开头，为 4 时是头部的结尾
+    __u32 name, name_matched;                   // 在一行的开头，哪些名称还可能匹配（rkpBpf_name_xxx 的位），已经匹配了几个字节
+    __s32 ua_begin, ua_end;                     // UA 的值的位置，相对于应用层数据的开头，没有找到时为 -1
+    __u32 uaEnd_matched;
+    __u32 scanned;                              // 已经扫描过的字节数
+};
+struct rkpBpf_progress
+{
+    struct rkpBpf_state state;
+    __u8 data[RKP_SCAN_CHUNK];                  // 当前块的内容
+};
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct rkpBpf_progress);
+} rkpBpf_progress SEC(".maps");
+
+static __always_inline void rkpBpf_inc(__u32 i)
+{
+    __u64* v = bpf_map_lookup_elem(&rkpBpf_stat, &i);
+    if(v)
+        (*v)++;
+}
+
+// 与模块的 rkpRule 一样，在一行的开头不区分大小写地匹配这些名称（都转成小写，包括后面的冒号）。
+// 名称按小端序装在立即数中，第 i 个字节就是第 i 个字符。不用字符串常量，这样不需要加载器支持全局数据；
+// 也不用 switch，每个字节只多一次移位，验证器在每一轮循环中要走的分支少
+enum
+{
+    rkpBpf_name_ua = 1,                         // "user-agent:"
+    rkpBpf_name_contentLength = 2,              // "content-length:"
+    rkpBpf_name_transferEncoding = 4,           // "transfer-encoding:"
+    rkpBpf_name_all = 7
+};
+#define rkpBpf_method_done 0xFF
+#define rkpBpf_method_max 16                    // 方法最长多少个字母
+static __always_inline unsigned char rkpBpf_name(__u32 name, __u32 i)
+{
+    __u64 w0, w1, w2;
+    if(name == rkpBpf_name_ua)
+        w0 = 0x6567612D72657375ULL, w1 = 0x3A746EULL, w2 = 0;
+    else if(name == rkpBpf_name_contentLength)
+        w0 = 0x2D746E65746E6F63ULL, w1 = 0x3A6874676E656CULL, w2 = 0;
+    else
+        w0 = 0x726566736E617274ULL, w1 = 0x6E69646F636E652DULL, w2 = 0x3A67ULL;
+    if(i >= 24)
+        return 0;
+    return ((i < 8 ? w0 : i < 16 ? w1 : w2) >> (i % 8 * 8)) & 0xFF;
+}
+static __always_inline unsigned char rkpBpf_crlf(__u32 i)
+{
+    return i % 2 == 0 ? '\r' : '\n';
+}
+
+static __always_inline int rkpBpf_punt(struct __sk_buff* skb, const struct rkpBpf_flow* flow, _Bool new_flow)
+{
+    __u8 one = 1;
+    skb -> mark |= RKP_MARK_CAPTURE;
+    if(new_flow)
+    {
+        bpf_map_update_elem(&rkpBpf_punted, flow, &one, BPF_ANY);
+        rkpBpf_inc(rkpBpf_stat_punted);
+    }
+    rkpBpf_inc(rkpBpf_stat_punted_packets);
+    return TC_ACT_OK;
+}
+
+__attribute__((noinline)) int rkpBpf_rewrite(struct __sk_buff* skb, __u64 off_l4, __u64 off_app, __u64 ua_begin, __u64 ua_end)
+// 修改 [ua_begin, ua_end)，偏移都相对于应用层数据的开头。按 4 字节对齐后整体读出、修改、写回，再用 bpf_csum_diff 的结果修正 TCP 校验和。
+// 应用层数据的开头相对于 TCP 头是 4 字节对齐的，所以这里的对齐与校验和的 16 位字对齐一致。
+// 这是一个全局函数，验证器单独验证它一次，参数都当作任意的 64 位值，所以参数都声明为 64 位：声明为 32 位的话，编译器认为高 32 位是 0，
+// 检查范围时只检查低 32 位，验证器却不知道整个寄存器的范围。如果内联到扫描的循环中，验证器会把 UA 的位置当作需要精确跟踪的值，
+// 循环中 UA 在不同位置结束的每一条路径都要一直验证到程序结束，超过指令数的限制
+{
+    __u32 zero = 0, i;
+    __u64 begin = ua_begin & ~3ULL, end = (ua_end + 3) & ~3ULL, n = end - begin;
+    struct rkpBpf_buff* buff = bpf_map_lookup_elem(&rkpBpf_buff, &zero);
+    __s64 diff;
+    if(!buff || ua_end <= ua_begin || n == 0 || n > RKP_UA_MAX + 8)
+        return -1;
+    // 读两遍，to 中 UA 以外的部分就不需要再逐字节复制
+    if(bpf_skb_load_bytes(skb, off_app + begin, buff -> from, n) < 0 || bpf_skb_load_bytes(skb, off_app + begin, buff -> to, n) < 0)
+        return -1;
+    // 每一轮都只有继续和结束两条路径，验证器不需要按 UA 的位置分别验证。RKP_UA 的长度是常量，展开后每个字符都是立即数，同样不需要全局数据。
+    // 通过 volatile 写入，不然编译器会把这两个循环合并成 memcpy 和 memset，BPF 中没有这两个函数
+    volatile __u8* to = buff -> to;
+#pragma unroll
+    for(i = 0; i < sizeof(RKP_UA) - 1; i++)
+    {
+        if(i >= ua_end - ua_begin)
+            break;
+        to[((ua_begin & 3) + i) & (RKP_UA_MAX + 7)] = RKP_UA[i];
+    }
+    for(i = sizeof(RKP_UA) - 1; i < RKP_UA_MAX; i++)
+    {
+        if(i >= ua_end - ua_begin)
+            break;
+        to[((ua_begin & 3) + i) & (RKP_UA_MAX + 7)] = ' ';
+    }
+    diff = bpf_csum_diff((__be32*)buff -> from, n, (__be32*)buff -> to, n, 0);
+    if(diff < 0)
+        return -1;
+    if(bpf_skb_store_bytes(skb, off_app + begin, buff -> to, n, 0) < 0)
+        return -1;
+    // 数据和校验和字段的变化相互抵消，CHECKSUM_COMPLETE 的 skb -> csum 不需要修改
+    if(bpf_l4_csum_replace(skb, off_l4 + offsetof(struct tcphdr, check), 0, diff, 0) < 0)
+        return -1;
+    return 0;
+}
+
+__attribute__((noinline)) int rkpBpf_scan(struct __sk_buff* skb, __u64 off_app, __u64 base, __u64 len)
+// 扫描应用层数据中从 base 开始的一块，len 是从 base 到应用层数据末尾的长度。用 bpf_skb_load_bytes 读出，不要求数据在线性区中。
+// 找到了头部的结尾时返回 1，需要继续扫描下一块时返回 0，需要交给模块（包括出错）时返回 -1。
+// 与 rkpBpf_rewrite 一样是全局函数，只验证一次：如果在包上直接用一个两千多轮的循环，验证器每一轮都要重新验证所有的分支，会超过指令数的限制
+{
+    __u32 zero = 0, i, k;
+    __u64 n = len < RKP_SCAN_CHUNK ? len : RKP_SCAN_CHUNK;
+    struct rkpBpf_progress* s = bpf_map_lookup_elem(&rkpBpf_progress, &zero);
+    if(!s || n == 0)
+        return -1;
+    if(bpf_skb_load_bytes(skb, off_app + base, s -> data, n) < 0)
+        return -1;
+    for(i = 0; i < RKP_SCAN_CHUNK && i < n; i++)
+    {
+        struct rkpBpf_state* st = &s -> state;
+        unsigned char c = s -> data[i], lower = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+        st -> scanned = base + i + 1;
+
+        // 包要以请求行开头，即大写字母组成的方法和一个空格。不是的话，不知道它是头部的后半部分、请求体还是别的什么，交给模块
+        if(st -> method != rkpBpf_method_done)
+        {
+            if(c == ' ' && st -> method != 0)
+                st -> method = rkpBpf_method_done;
+            else if(c >= 'A' && c <= 'Z' && st -> method < rkpBpf_method_max)
+                st -> method++;
+            else
+                return -1;
+            continue;
+        }
+
+        // 在 UA 的值中：与 __rkpStream_scan 相同，跳过开头的空白，找到 \r\n 以后回到一行的开头
+        if(st -> ua_begin >= 0 && st -> ua_end < 0)
+        {
+            if((c == ' ' || c == '\t') && st -> ua_begin == base + i)
+            {
+                st -> ua_begin++;
+                continue;
+            }
+            if(c == rkpBpf_crlf(st -> uaEnd_matched))
+            {
+                st -> uaEnd_matched++;
+                if(st -> uaEnd_matched == 2)
+                {
+                    st -> ua_end = base + i + 1 - 2;
+                    st -> crlf = 2;
+                    st -> name = rkpBpf_name_all & ~rkpBpf_name_ua;
+                    st -> name_matched = 0;
+                }
+            }
+            else
+                st -> uaEnd_matched = 0;
+            continue;
+        }
+
+        // 与模块的自动机一样，在不能继续匹配时，只有刚遇到的 \r 还可能是新的开头
+        if(c == rkpBpf_crlf(st -> crlf))
+            st -> crlf++;
+        else
+            st -> crlf = c == '\r';
+        if(st -> crlf == 4)
+            return 1;
+        if(st -> crlf == 2)
+        {
+            // 只修改第一个 UA
+            st -> name = st -> ua_begin < 0 ? rkpBpf_name_all : rkpBpf_name_all & ~rkpBpf_name_ua;
+            st -> name_matched = 0;
+            continue;
+        }
+        if(st -> name == 0)
+            continue;
+#pragma unroll
+        for(k = 1; k < rkpBpf_name_all; k <<= 1)
+            if((st -> name & k) && lower != rkpBpf_name(k, st -> name_matched))
+                st -> name &= ~k;
+        st -> name_matched++;
+        // 名称的长度互不相同，匹配到冒号时只剩下一个
+        if(st -> name != 0 && c == ':')
+        {
+            // 有请求体时，不知道它在哪里结束，之后的包是请求体还是下一个请求，交给模块
+            if(st -> name != rkpBpf_name_ua)
+                return -1;
+            st -> ua_begin = base + i + 1;
+            st -> uaEnd_matched = 0;
+            st -> name = 0;
+        }
+    }
+    return 0;
+}
+
+SEC("tc")
+int rkpBpf_ingress(struct __sk_buff* skb)
+{
+    void *data, *data_end;
+    struct iphdr* iph;
+    struct tcphdr* tcph;
+    struct rkpBpf_flow flow = {};
+    struct rkpBpf_progress* s;
+    __u32 off_l4, off_app, len_app, i, zero = 0;
+    __s32 ua_begin, ua_end;
+    int rtn = 0;
+
+    if(skb -> protocol != bpf_htons(ETH_P_IP))
+        return TC_ACT_OK;
+    data = (void*)(long)skb -> data;
+    data_end = (void*)(long)skb -> data_end;
+    iph = data + sizeof(struct ethhdr);
+    if((void*)(iph + 1) > data_end)
+        return TC_ACT_OK;
+    if(iph -> protocol != IPPROTO_TCP || iph -> ihl < 5 || (iph -> frag_off & bpf_htons(0x3FFF)))
+        return TC_ACT_OK;
+    // autocapture 的规则，与 rkpSetting_capture 相同
+    if((bpf_ntohl(iph -> saddr) & 0xFFFF0000) != ((192 << 24) | (168 << 16))
+            || (bpf_ntohl(iph -> daddr) & 0xFFFF0000) == ((192 << 24) | (168 << 16)))
+        return TC_ACT_OK;
+    off_l4 = sizeof(struct ethhdr) + iph -> ihl * 4;
+    tcph = data + off_l4;
+    if((void*)(tcph + 1) > data_end || tcph -> dest != bpf_htons(80))
+        return TC_ACT_OK;
+
+    flow.saddr = iph -> saddr;
+    flow.daddr = iph -> daddr;
+    flow.sport = tcph -> source;
+    flow.dport = tcph -> dest;
+    if(bpf_map_lookup_elem(&rkpBpf_punted, &flow))
+    {
+        // 连接结束后不再需要记住它，否则已经关闭的流会占着 LRU，把还在进行中的流挤出去
+        if(tcph -> rst || tcph -> fin)
+            bpf_map_delete_elem(&rkpBpf_punted, &flow);
+        return rkpBpf_punt(skb, &flow, 0);
+    }
+
+    // 以太网帧可能有填充，应用层数据的长度按 IP 头中的总长度计算
+    off_app = off_l4 + tcph -> doff * 4;
+    if(bpf_ntohs(iph -> tot_len) <= iph -> ihl * 4 + tcph -> doff * 4)
+        return TC_ACT_OK;
+    len_app = bpf_ntohs(iph -> tot_len) - iph -> ihl * 4 - tcph -> doff * 4;
+
+    s = bpf_map_lookup_elem(&rkpBpf_progress, &zero);
+    if(!s)
+        return TC_ACT_OK;
+    __builtin_memset(&s -> state, 0, sizeof(s -> state));
+    s -> state.ua_begin = s -> state.ua_end = -1;
+    // 每次扫描一块，块的数量是常量，验证器只需要展开这个外层循环，每一块都调用同一个已经验证过的函数
+    for(i = 0; i < RKP_SCAN_MAX / RKP_SCAN_CHUNK; i++)
+    {
+        __u32 base = i * RKP_SCAN_CHUNK;
+        if(base >= len_app)
+            break;
+        rtn = rkpBpf_scan(skb, off_app, base, len_app - base);
+        if(rtn != 0)
+            break;
+    }
+    // 只处理恰好是一个完整的头部的包。头部不完整时，后面的包中还可能有 UA；头部后面还有数据时，不知道它是请求体还是下一个请求
+    if(rtn != 1 || s -> state.scanned != len_app)
+        return rkpBpf_punt(skb, &flow, 1);
+    ua_begin = s -> state.ua_begin;
+    ua_end = s -> state.ua_end;
+    // 没有 UA，或者 UA 为空（模块中的 uaGood），都不需要修改
+    if(ua_begin < 0 || ua_end <= ua_begin)
+    {
+        rkpBpf_inc(rkpBpf_stat_passed);
+        return TC_ACT_OK;
+    }
+    if(ua_end - ua_begin > RKP_UA_MAX || rkpBpf_rewrite(skb, off_l4, off_app, ua_begin, ua_end) < 0)
+        return rkpBpf_punt(skb, &flow, 1);
+    rkpBpf_inc(rkpBpf_stat_rewritten);
+    return TC_ACT_OK;
+}
+
+char _license[] SEC("license") = "GPL";
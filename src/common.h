@@ -14,29 +14,39 @@
 #include <linux/moduleparam.h>
 #include <linux/time.h>
 #include <linux/mutex.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/timex.h>
+#include <linux/relay.h>
+#include <linux/jump_label.h>
+#include <linux/percpu_counter.h>
+#include <linux/shrinker.h>
+#include <linux/vmalloc.h>
+#include <linux/smp.h>
 
 typedef _Bool bool;
 #define static_assert _Static_assert
 
-const static unsigned char* str_uaBegin = "User-Agent: ";
+// 其它需要在头部中匹配的字符串（各个头部的名称和 http 头的结尾）都编译到 rkpRule 的自动机中了
 const static unsigned char* str_uaEnd = "\r\n";
-const static unsigned char* str_headEnd = "\r\n\r\n";
 static unsigned char str_uaRkp[16];
 
-void* rkpMalloc(unsigned size)
-{
-    void* p = kmalloc(size, GFP_NOWAIT);
-    if(p == 0)
-        printk("rkp-ua: malloc failed.\n");
-    return p;
-}
-void rkpFree(void* p)
-{
-    kfree(p);
-}
-
 #include "rkpSetting.h"
+#include "rkpStat.h"
+#include "rkpMem.h"
+#include "rkpRule.h"
+#include "rkpRecord.h"
+// 只有 xmurp-ua.c 一个编译单元，所以直接在这里生成跟踪点
+#define CREATE_TRACE_POINTS
+#include "rkpTrace.h"
+
 #include "rkpPacket.h"
 #include "rkpMap.h"
+#include "rkpCache.h"
 #include "rkpStream.h"
 #include "rkpManager.h"
\ No newline at end of file
@@ -0,0 +1,195 @@
+#pragma once
+#include "common.h"
+
+// 无状态优先模式（模块参数 stateless）下，最近没有建立流就处理完的流，每个 CPU 一份。
+// 没有对应的 rkpStream 的包靠它判断是否按顺序到达；重传的包（可能和第一次的分段不同）靠它记下的映射得到和第一次相同的修改。
+// 同一个流的包通常由同一个 CPU 处理。换了 CPU 或者条目被挤掉时，退回到不知道这个流的情况：和不打开 stateless 时一样为它建立流。
+// 连接结束（FIN、RST）、重新握手或者所属的 rkpManager 被删除时删除条目，这样表中留下的都是可能还活着的流。
+// 每个 CPU 的表的大小由模块参数 stateless_cache 决定，组数向上取整到 2 的幂
+#define rkpCache_nWay 4
+#define rkpCache_maxSet (1U << 18)              // 组数的上限，避免参数太大时大小溢出
+#define rkpCache_nMap 4                         // 每个流最多记下几个映射，记不下时为这个流建立流
+
+struct rkpCache_map
+// 同 rkpMap，去掉了链表的指针
+{
+    int32_t begin;
+    u_int16_t length;
+    u_int8_t rule;
+};
+struct rkpCache
+{
+    u_int32_t owner;                            // 所属的 rkpManager 的编号，为 0 时这个条目是空的
+    u_int32_t id[3];                            // 同 rkpStream
+    int32_t end;                                // 已经处理到的位置，即下一个包应当从哪个绝对序列号开始
+    u_int32_t last_used;                        // 最后一次用到时 rkpCache_table 的 clock，一组中最久没有用到的条目先被替换
+    u_int32_t last_active;                      // 最后一次用到时 jiffies 的低 32 位。超过 time_keepalive 没有用到的流当作已经结束了
+    u_int8_t n_map;
+    struct rkpCache_map map[rkpCache_nMap];     // 按序列号递增
+};
+struct rkpCache_table
+{
+    u_int32_t clock;                            // 每用到一次条目加一。jiffies 太粗，同一个 jiffy 中会用到很多条目
+    struct rkpCache set[][rkpCache_nWay];       // rkpCache_nSet 组
+};
+static unsigned rkpCache_nSet, rkpCache_size;   // 每个表的组数和字节数
+static void* rkpCache_tables;
+        // 只在 stateless 打开时分配，每个 CPU 一个表，按 CPU 的编号连续存放。表通常比 alloc_percpu 允许的 32 KB 大，所以用 vzalloc 一起分配
+
+int rkpCache_init(void);
+void rkpCache_exit(void);
+void rkpCache_purge(u_int32_t);                 // 删除属于一个 rkpManager（参数为它的编号）的全部条目，在它被删除时调用，不能在中断中调用
+
+struct rkpCache* rkpCache_find(u_int32_t, const u_int32_t*);  // 在本 CPU 的表中查找，参数为 rkpManager 的编号和流的 id，找不到时返回 0
+bool rkpCache_put(u_int32_t, const u_int32_t*, int32_t, const struct rkpMap*);
+        // 记下一个流处理到了哪里（第三个参数），以及新生成的映射（第四个参数，为一个链表）。流不在表中时替换同一组中最久没有用到的条目。
+        // 映射太长，或者加上已经记下的映射超过 rkpCache_nMap 个时什么都不做，返回 false。
+        // 已经记下的映射不能丢：服务端的确认通常由别的 CPU 处理，rkpCache_refresh 很少有机会删除它们，而没有确认的映射丢掉后重传的包就改不了了
+void rkpCache_refresh(struct rkpCache*, int32_t);            // 收到服务端的确认：删除已经确认的映射，已经处理到的位置落后于确认号的话跟上
+void rkpCache_modify(const struct rkpCache*, struct rkpPacket*);        // 用记下的映射修改一个重传的包
+void rkpCache_drop(struct rkpCache*);                           // 删除一个条目，例如连接结束时
+struct rkpMap* rkpCache_take(struct rkpCache*);
+        // 为这个流建立了 rkpStream 时调用：将记下的映射转成 rkpMap 的链表交给它，并清空这个条目。分配失败的映射会被丢掉
+
+struct rkpCache_table* __rkpCache_table(void);                  // 本 CPU 的表
+unsigned __rkpCache_set(const u_int32_t*);                      // 流属于哪一组
+void __rkpCache_purge(void*);                                   // rkpCache_purge 在每个 CPU 上执行的部分，参数指向 rkpManager 的编号
+
+int rkpCache_init(void)
+{
+    if(!stateless)
+        return 0;
+    for(rkpCache_nSet = 1; rkpCache_nSet * rkpCache_nWay < stateless_cache && rkpCache_nSet < rkpCache_maxSet; rkpCache_nSet <<= 1);
+    rkpCache_size = ALIGN(sizeof(struct rkpCache_table) + sizeof(struct rkpCache) * rkpCache_nWay * rkpCache_nSet, SMP_CACHE_BYTES);
+    rkpCache_tables = vzalloc((size_t)rkpCache_size * nr_cpu_ids);
+    return rkpCache_tables == 0 ? -ENOMEM : 0;
+}
+void rkpCache_exit(void)
+{
+    vfree(rkpCache_tables);
+    rkpCache_tables = 0;
+}
+void rkpCache_purge(u_int32_t owner)
+{
+    if(rkpCache_tables == 0)
+        return;
+    // 每个 CPU 的表只由它自己修改，而且都是在 rkpManager 的锁中（关了中断），所以让每个 CPU 在中断中清理自己的表
+    on_each_cpu(__rkpCache_purge, &owner, 1);
+}
+
+struct rkpCache* rkpCache_find(u_int32_t owner, const u_int32_t* id)
+{
+    struct rkpCache_table* table = __rkpCache_table();
+    struct rkpCache* set = table -> set[__rkpCache_set(id)];
+    unsigned i;
+    for(i = 0; i < rkpCache_nWay; i++)
+        if(set[i].owner == owner && memcmp(set[i].id, id, 3 * sizeof(u_int32_t)) == 0)
+        {
+            set[i].last_used = ++table -> clock;
+            set[i].last_active = jiffies;
+            return &set[i];
+        }
+    return 0;
+}
+bool rkpCache_put(u_int32_t owner, const u_int32_t* id, int32_t end, const struct rkpMap* rkpml)
+{
+    struct rkpCache* rkpc = rkpCache_find(owner, id);
+    const struct rkpMap* rkpm;
+    unsigned n = 0;
+
+    for(rkpm = rkpml; rkpm != 0; rkpm = rkpm -> next, n++)
+        if(n == rkpCache_nMap || rkpm -> length > 0xFFFF)
+            return false;
+    if(rkpc != 0 && rkpc -> n_map + n > rkpCache_nMap)
+        return false;
+    if(rkpc == 0)
+    {
+        struct rkpCache_table* table = __rkpCache_table();
+        struct rkpCache* set = table -> set[__rkpCache_set(id)];
+        unsigned i;
+        rkpc = &set[0];
+        for(i = 0; i < rkpCache_nWay && rkpc -> owner != 0; i++)
+            if(set[i].owner == 0 || table -> clock - set[i].last_used > table -> clock - rkpc -> last_used)
+                rkpc = &set[i];
+        // 挤掉的流之后的包会建立流，这个计数多的话应当调大 stateless_cache。
+        // 很久没有用到的流（没有看到 FIN 就消失的连接）和 time_keepalive 清理掉的流一样，不算挤掉
+        if(rkpc -> owner != 0 && (u_int32_t)jiffies - rkpc -> last_active < (u_int32_t)time_keepalive * HZ)
+            rkpStat_inc(stateless_evicted);
+        rkpc -> owner = owner;
+        memcpy(rkpc -> id, id, 3 * sizeof(u_int32_t));
+        rkpc -> last_used = ++table -> clock;
+        rkpc -> last_active = jiffies;
+        rkpc -> n_map = 0;
+    }
+    rkpc -> end = end;
+    for(rkpm = rkpml; rkpm != 0; rkpm = rkpm -> next, rkpc -> n_map++)
+    {
+        rkpc -> map[rkpc -> n_map].begin = rkpm -> begin;
+        rkpc -> map[rkpc -> n_map].length = rkpm -> length;
+        rkpc -> map[rkpc -> n_map].rule = rkpm -> rule;
+    }
+    return true;
+}
+void rkpCache_refresh(struct rkpCache* rkpc, int32_t seq)
+{
+    unsigned k;
+    // 同 rkpMap_refresh
+    for(k = 0; k < rkpc -> n_map; k++)
+        if((int32_t)(seq - rkpc -> map[k].begin) - (int32_t)rkpc -> map[k].length < 0)
+            break;
+    memmove(rkpc -> map, rkpc -> map + k, sizeof(struct rkpCache_map) * (rkpc -> n_map - k));
+    rkpc -> n_map -= k;
+    // 条目被挤掉以后，重传的包可能又建立了一个处理位置落后的条目，服务端的确认可以把它纠正过来
+    if((int32_t)(seq - rkpc -> end) > 0)
+        rkpc -> end = seq;
+}
+void rkpCache_modify(const struct rkpCache* rkpc, struct rkpPacket* rkpp)
+{
+    struct rkpMap map[rkpCache_nMap], *rkpml = &map[0];
+    unsigned i;
+    if(rkpc -> n_map == 0)
+        return;
+    // 在栈上临时拼出一个 rkpMap 的链表
+    for(i = 0; i < rkpc -> n_map; i++)
+    {
+        map[i].begin = rkpc -> map[i].begin;
+        map[i].length = rkpc -> map[i].length;
+        map[i].rule = rkpc -> map[i].rule;
+        map[i].prev = i == 0 ? 0 : &map[i - 1];
+        map[i].next = i + 1 == rkpc -> n_map ? 0 : &map[i + 1];
+    }
+    rkpMap_modify(&rkpml, &rkpp);
+}
+void rkpCache_drop(struct rkpCache* rkpc)
+{
+    rkpc -> owner = 0;
+    rkpc -> n_map = 0;
+}
+struct rkpMap* rkpCache_take(struct rkpCache* rkpc)
+{
+    struct rkpMap* rkpml = 0;
+    unsigned i;
+    for(i = 0; i < rkpc -> n_map; i++)
+        rkpMap_insert_end(&rkpml, rkpMap_new(rkpc -> map[i].begin, rkpc -> map[i].begin + rkpc -> map[i].length, rkpc -> map[i].rule));
+    rkpCache_drop(rkpc);
+    return rkpml;
+}
+
+struct rkpCache_table* __rkpCache_table(void)
+{
+    return (struct rkpCache_table*)((char*)rkpCache_tables + (size_t)rkpCache_size * smp_processor_id());
+}
+unsigned __rkpCache_set(const u_int32_t* id)
+{
+    return rkpRecord_hash(id) & (rkpCache_nSet - 1);
+}
+void __rkpCache_purge(void* info)
+{
+    struct rkpCache_table* table = __rkpCache_table();
+    u_int32_t owner = *(const u_int32_t*)info;
+    unsigned i, j;
+    for(i = 0; i < rkpCache_nSet; i++)
+        for(j = 0; j < rkpCache_nWay; j++)
+            if(table -> set[i][j].owner == owner)
+                rkpCache_drop(&table -> set[i][j]);
+}
@@ -6,13 +6,46 @@ struct rkpManager
     struct rkpStream* data[256];        // 按照两端口之和的低 8 位索引
     spinlock_t lock;                    // 线程锁
     struct timer_list timer;            // 定时器，用来定时清理不需要的流
+    struct list_head list;              // 所有命名空间的 rkpManager 串成一个链表，方便 debugfs 等全局的功能遍历
+    struct list_head held;              // 有截留的包的流（挂的是它们的 cold），由锁保护
+    u_int64_t lock_begin;               // 取得锁的时间，打开 profile 时用来统计持有锁的时长，由锁保护
+    u_int32_t id;                       // 编号，从 1 开始，不会重复使用。rkpCache 用它区分不同命名空间的流
+    struct rkpStat __percpu* stat;      // 这个命名空间的计数。持有锁时 rkpStat_inc 等记到这里
+    struct rkpStat __percpu* stat_outer;        // 取得锁之前这个 CPU 上的计数记到哪里，解锁时恢复，由锁保护
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+    struct tasklet_hrtimer hold_timer;  // 旧的内核没有 HRTIMER_MODE_ABS_SOFT，用 tasklet_hrtimer 使回调在软中断中执行
+#else
+    struct hrtimer hold_timer;          // 截留时长的定时器，所有流共用一个，在最早的截留到期时触发。回调在软中断中执行
+#endif
 };
 
+// 所有的 rkpManager，由 rkpManager_list_mutex 保护
+static LIST_HEAD(rkpManager_list);
+static DEFINE_MUTEX(rkpManager_list_mutex);
+static u_int32_t rkpManager_lastId;     // 最后一个分配的编号，由 rkpManager_list_mutex 保护
+
 struct rkpManager* rkpManager_new(void);
 void rkpManager_delete(struct rkpManager*);
 
+unsigned rkpManager_snapshot(struct rkpManager*, unsigned, struct rkpStream_info*, unsigned);
+        // 对指定的桶中的流生成快照，最多写入最后一个参数指定的个数，返回桶中流的个数。只在这期间持有锁
+
 unsigned rkpManager_execute(struct rkpManager*, struct sk_buff*);   // 处理一个数据包。返回值为 rkpStream_execute 的返回值。
 unsigned __rkpManager_execute(struct rkpManager*, struct rkpPacket*);
+unsigned __rkpManager_stateless(struct rkpManager*, struct rkpPacket*);
+        // 无状态优先模式下处理一个没有对应的流的包。先用栈上的临时的流处理，请求在包中完整地结束时只在 rkpCache 中记下映射；
+        // 请求在包的末尾还没有结束（需要截留或者跳过 body）、包没有按顺序到达，或者 rkpCache 中没有这个流（连 SYN 都没有记下）时，才建立流
+void __rkpManager_insert(struct rkpManager*, unsigned, struct rkpStream*);      // 将一个新的流放到指定的桶的开头
+
+unsigned rkpManager_shrink(struct rkpManager*, unsigned, struct rkpPacket**);
+        // 内存紧张时释放一些东西，第二个参数为希望释放的个数，返回实际释放的个数。
+        // 先删除最久没有活动的、停在请求边界上的休眠的流，不够的话再放弃截留，放出的包放到第三个参数指定的链表中，由调用者在解锁后发出。
+        // 每次只对一个桶加锁，不会长时间关着中断
+unsigned rkpManager_shrinkable(struct rkpManager*);
+        // 返回 rkpManager_shrink 现在能删除的流的个数（不包括截留的包），同样每次只对一个桶加锁
+bool __rkpManager_shrinkable(const struct rkpStream*, unsigned);
+        // 流是否可以被 rkpManager_shrink 删除：休眠、停在请求边界上，并且至少第二个参数（jiffies）那么久没有活动
+void __rkpManager_unlink(struct rkpManager*, unsigned, struct rkpStream*);      // 将一个流从指定的桶中取出，但不释放
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
 void __rkpManager_refresh(unsigned long);                           // 清理长时间不活动的流，参数实际上是 rkpm 的地址
@@ -20,18 +53,32 @@ void __rkpManager_refresh(unsigned long);                           // 清理长
 void __rkpManager_refresh(struct timer_list*);
 #endif
 
+void __rkpManager_hold(struct rkpManager*, struct rkpStream*);
+        // 处理完一个包之后调用，流中有截留的包时挂到 held 链表上，并在定时器没有运行时启动它。调用者需要持有锁
+enum hrtimer_restart __rkpManager_hold_expire(struct hrtimer*);
+        // 将截留超过 time_hold 的流原样放出（状态置为 waiting，这个请求不再修改），再按剩下的流中最早的截留重新启动定时器
+struct hrtimer* __rkpManager_hold_timer(struct rkpManager*);
+void __rkpManager_hold_start(struct rkpManager*, u_int64_t);   // 启动定时器，在第二个参数指定的时间（ktime_get_ns 的纳秒数）触发
+
 void __rkpManager_lock(struct rkpManager*, unsigned long*);
 void __rkpManager_unlock(struct rkpManager*, unsigned long);
 
 struct rkpManager* rkpManager_new(void)
 {
     struct rkpManager* rkpm = (struct rkpManager*)rkpMalloc(sizeof(struct rkpManager));
-    if(debug)
-        printk("rkpManager_new\n");
     if(rkpm == 0)
         return 0;
+    rkpm -> stat = alloc_percpu(struct rkpStat);
+    if(rkpm -> stat == 0)
+    {
+        rkpStat_inc(malloc_failed);
+        rkpFree(rkpm);
+        return 0;
+    }
+    rkpm -> stat_outer = 0;
     memset(rkpm -> data, 0, sizeof(struct rkpStream*) * 256);
     spin_lock_init(&rkpm -> lock);
+    rkpm -> lock_begin = 0;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
     init_timer(&rkpm -> timer);
     rkpm -> timer.function = __rkpManager_refresh;
@@ -39,19 +86,40 @@ struct rkpManager* rkpManager_new(void)
     rkpm -> timer.expires = jiffies + time_keepalive * HZ;
     add_timer(&rkpm -> timer);
 #else
-    rkpm -> timer.expires = jiffies + time_keepalive * HZ;
     timer_setup(&rkpm -> timer, __rkpManager_refresh, 0);
+    rkpm -> timer.expires = jiffies + time_keepalive * HZ;
+    add_timer(&rkpm -> timer);
 #endif
+    INIT_LIST_HEAD(&rkpm -> held);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+    tasklet_hrtimer_init(&rkpm -> hold_timer, __rkpManager_hold_expire, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+#else
+    hrtimer_init(&rkpm -> hold_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+    rkpm -> hold_timer.function = __rkpManager_hold_expire;
+#endif
+    mutex_lock(&rkpManager_list_mutex);
+    rkpm -> id = ++rkpManager_lastId;
+    list_add_tail(&rkpm -> list, &rkpManager_list);
+    mutex_unlock(&rkpManager_list_mutex);
     return rkpm;
 }
 void rkpManager_delete(struct rkpManager* rkpm)
 {
     unsigned i;
     unsigned long flag;
-    if(debug)
-        printk("rkpManager_delete\n");
+    mutex_lock(&rkpManager_list_mutex);
+    list_del(&rkpm -> list);
+    mutex_unlock(&rkpManager_list_mutex);
+    // 定时器的回调会重新添加自己，必须在加锁之前等它彻底停下来
+    del_timer_sync(&rkpm -> timer);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+    tasklet_hrtimer_cancel(&rkpm -> hold_timer);
+#else
+    hrtimer_cancel(&rkpm -> hold_timer);
+#endif
+    // 编号不会重复使用，但留在 rkpCache 中的条目会一直占着位置，并且被挤掉时会被当作活着的流计数
+    rkpCache_purge(rkpm -> id);
     __rkpManager_lock(rkpm, &flag);
-    del_timer(&rkpm -> timer);
     for(i = 0; i < 256; i++)
     {
         struct rkpStream* rkps = rkpm -> data[i];
@@ -63,28 +131,38 @@ void rkpManager_delete(struct rkpManager* rkpm)
         }
     }
     __rkpManager_unlock(rkpm, flag);
+    // 命名空间没有了，它的计数并到模块的计数中，debugfs 等处的总数不会因此变小
+    rkpStat_fold(rkpm -> stat);
+    free_percpu(rkpm -> stat);
     rkpFree(rkpm);
 }
 
+unsigned rkpManager_snapshot(struct rkpManager* rkpm, unsigned i, struct rkpStream_info* info, unsigned n)
+{
+    unsigned long flag;
+    unsigned rtn = 0;
+    const struct rkpStream* rkps;
+    __rkpManager_lock(rkpm, &flag);
+    for(rkps = rkpm -> data[i]; rkps != 0; rkps = rkps -> next, rtn++)
+        if(rtn < n)
+            rkpStream_info(rkps, info + rtn);
+    __rkpManager_unlock(rkpm, flag);
+    return rtn;
+}
+
 unsigned rkpManager_execute(struct rkpManager* rkpm, struct sk_buff* skb)
 {
     unsigned long flag;
     unsigned rtn;
     struct rkpPacket* rkpp;
-    if(debug)
-        printk("rkpManager_execute\n");
     __rkpManager_lock(rkpm, &flag);
     rkpp = rkpPacket_new(skb, rkpSetting_ack(skb));
-    rtn = __rkpManager_execute(rkpm, rkpp);
-    if(debug)
+    if(rkpp == 0)
     {
-        if(rtn == NF_ACCEPT)
-            printk("returned NF_ACCEPT.\n");
-        else if(rtn == NF_DROP)
-            printk("returned NF_DROP.\n");
-        else if(rtn == NF_STOLEN)
-            printk("returned NF_STOLEN.\n");
+        __rkpManager_unlock(rkpm, flag);
+        return NF_ACCEPT;
     }
+    rtn = __rkpManager_execute(rkpm, rkpp);
     __rkpManager_unlock(rkpm, flag);
     if(rtn == NF_ACCEPT || rtn == NF_DROP)
         rkpPacket_delete(rkpp);
@@ -93,25 +171,226 @@ unsigned rkpManager_execute(struct rkpManager* rkpm, struct sk_buff* skb)
 unsigned __rkpManager_execute(struct rkpManager* rkpm, struct rkpPacket* rkpp)
 {
     struct rkpStream *rkps, *rkps_new;
+    unsigned rtn;
+    u_int64_t t = rkpStat_stage_begin();
 
     // 搜索是否有符合条件的流
-    for(rkps = rkpm -> data[rkpp -> sid]; rkps != 0; rkps = rkps -> next)
-        if(rkpStream_belongTo(rkps, rkpp))       // 找到了，执行即可
-            return rkpStream_execute(rkps, rkpp);
+    for(rkps = rkpm -> data[rkpp -> sid]; rkps != 0 && !rkpStream_belongTo(rkps, rkpp); rkps = rkps -> next);
+    rkpStat_stage_end(rkpStat_stage_lookup, t);
+    if(rkps != 0)       // 找到了，执行即可
+    {
+        rtn = rkpStream_execute(rkps, rkpp);
+        // 无状态优先模式下，流回到了请求的边界上就不再需要了，把映射留在 rkpCache 中以便修改重传的包。连接已经结束的话什么都不用留
+        if(stateless && rtn == NF_ACCEPT && rkpStream_boundary(rkps, rkpp) && (rkpPacket_fin(rkpp) || rkpPacket_rst(rkpp)
+                || rkpCache_put(rkpm -> id, rkps -> id, rkps -> seq_offset, rkps -> map)))
+        {
+            __rkpManager_unlink(rkpm, rkpp -> sid, rkps);
+            rkpStream_delete(rkps);
+            rkpStat_inc(stateless_demoted);
+        }
+        else
+            __rkpManager_hold(rkpm, rkps);
+        return rtn;
+    }
+    if(stateless)
+        return __rkpManager_stateless(rkpm, rkpp);
 
-    // 如果运行到这里的话，那就是没有找到了，新建一个流再执行
+    // 如果运行到这里的话，那就是没有找到了，新建一个流再执行。快要超过内存预算时不再追踪新的流，直接放行
+    if(rkpMem_near())
+    {
+        rkpStat_inc(budget_bypass);
+        return NF_ACCEPT;
+    }
     rkps_new = rkpStream_new(rkpp);
     if(rkps_new == 0)
         return NF_ACCEPT;
-    if(rkpm -> data[rkpp -> sid] == 0)
-        rkpm -> data[rkpp -> sid] = rkps_new;
-    else
+    __rkpManager_insert(rkpm, rkpp -> sid, rkps_new);
+    rtn = rkpStream_execute(rkps_new, rkpp);
+    __rkpManager_hold(rkpm, rkps_new);
+    return rtn;
+}
+unsigned __rkpManager_stateless(struct rkpManager* rkpm, struct rkpPacket* rkpp)
+{
+    struct rkpCache* rkpc = rkpCache_find(rkpm -> id, rkpp -> lid);
+    struct rkpStream tmp, *rkps;
+    struct rkpMap* rkpml;
+    unsigned rtn;
+    // 客户端不会再发出新的请求了，处理完这个包就删除条目，不让结束的连接占着表中的位置
+    bool closed = rkpPacket_fin(rkpp) || rkpPacket_rst(rkpp);
+
+    // 服务端的确认，删除已经确认的映射。服务端重置了连接的话删除条目
+    if(rkpp -> ack)
+    {
+        if(rkpc != 0 && rkpPacket_rst(rkpp))
+            rkpCache_drop(rkpc);
+        else if(rkpc != 0)
+            rkpCache_refresh(rkpc, rkpPacket_seqAck(rkpp, 0));
+        return NF_ACCEPT;
+    }
+    // 没有应用层数据的包不需要流。握手时记下第一个字节的序列号，这样第一个请求的包乱序时也能发现；
+    // 端口被重新使用时，上一个连接的映射和处理到的位置都不再有意义
+    if(rkpPacket_appLen(rkpp) == 0)
+    {
+        if(rkpc != 0 && (closed || rkpPacket_syn(rkpp)))
+            rkpCache_drop(rkpc);
+        if(rkpPacket_syn(rkpp))
+            rkpCache_put(rkpm -> id, rkpp -> lid, rkpPacket_seq(rkpp, 0) + 1, 0);
+        return NF_ACCEPT;
+    }
+    // 已经处理过的数据，使用记下的映射修改
+    if(rkpc != 0 && rkpPacket_seq(rkpp, rkpc -> end) < 0)
+    {
+        rkpStat_inc(retransmit);
+        rkpCache_modify(rkpc, rkpp);
+        if(closed)
+            rkpCache_drop(rkpc);
+        return NF_ACCEPT;
+    }
+    // 前面还有没收到的数据，需要一个流来截留这个包，流从已经处理到的位置开始。
+    // 不知道这个流时（连握手都没有记下，例如条目被挤掉、换了 CPU，或者连接在模块加载之前就建立了），不能假定包从一个请求的开头开始，
+    // 和不打开 stateless 时一样为它建立流，由流来判断之后的包是否按顺序到达，回到请求的边界上时再删除
+    if(rkpc == 0 || rkpPacket_seq(rkpp, rkpc -> end) > 0)
+    {
+        if(rkpMem_near())
+        {
+            rkpStat_inc(budget_bypass);
+            return NF_ACCEPT;
+        }
+        rkps = rkpStream_new(rkpp);
+        if(rkps == 0)
+            return NF_ACCEPT;
+        if(rkpc != 0)
+        {
+            rkps -> seq_offset = rkpc -> end;
+            rkps -> map = rkpCache_take(rkpc);
+        }
+        rkpStat_inc(stateless_promoted);
+        __rkpManager_insert(rkpm, rkpp -> sid, rkps);
+        rtn = rkpStream_execute(rkps, rkpp);
+        __rkpManager_hold(rkpm, rkps);
+        return rtn;
+    }
+
+    // 接得上已经处理过的数据，包从一个请求的开头开始。
+    // 处理完还停在请求的边界上的话，临时的流就可以扔掉了，不需要分配流，也不占用桶和 time_keepalive 那么久的内存
+    rkpStream_init(&tmp, rkpp);
+    rtn = rkpStream_execute(&tmp, rkpp);
+    if(rtn == NF_ACCEPT && rkpStream_boundary(&tmp, rkpp)
+            && (closed || rkpCache_put(rkpm -> id, tmp.id, tmp.seq_offset, tmp.map)))
     {
-        rkpm -> data[rkpp -> sid] -> prev = rkps_new;
-        rkps_new -> next = rkpm -> data[rkpp -> sid];
-        rkpm -> data[rkpp -> sid] = rkps_new;
+        if(closed)
+            rkpCache_drop(rkpc);
+        rkpStream_release(&tmp);
+        rkpStat_inc(stateless_handled);
+        return NF_ACCEPT;
     }
-    return rkpStream_execute(rkps_new, rkpp);
+
+    // 请求在包的末尾还没有结束，或者映射太多记不下，把临时的流搬到堆上接着追踪。快要超过内存预算或者分配失败时，像放弃截留一样放过这个请求
+    rkps = rkpMem_near() ? 0 : rkpStream_move(&tmp);
+    if(rkps == 0)
+    {
+        struct rkpPacket* rkppl = 0;
+        if(rkpMem_near())
+            rkpStat_inc(budget_bypass);
+        // 返回 NF_STOLEN 时包在 buff_scan 中，会和其它截留的包一起发出
+        rkpStream_flush(&tmp, &rkppl);
+        rkpPacket_sendl(&rkppl);
+        // 放过的包也处理过了，记下处理到的位置，否则下一个包看起来前面还有没收到的数据，会被截留到 time_hold。
+        // 这次生成的映射也记下，记不下的话删除条目，让下一个包像不知道这个流时那样处理
+        if(!rkpCache_put(rkpm -> id, tmp.id, tmp.seq_offset, tmp.map))
+            rkpCache_drop(rkpc);
+        rkpStream_release(&tmp);
+        return rtn;
+    }
+    // 之前记下的映射比这次生成的早，排在前面
+    rkpml = rkpCache_take(rkpc);
+    rkpMap_insert_end(&rkpml, rkps -> map);
+    rkps -> map = rkpml;
+    rkpStat_inc(stateless_promoted);
+    __rkpManager_insert(rkpm, rkpp -> sid, rkps);
+    __rkpManager_hold(rkpm, rkps);
+    return rtn;
+}
+void __rkpManager_insert(struct rkpManager* rkpm, unsigned i, struct rkpStream* rkps)
+{
+    if(rkpm -> data[i] != 0)
+    {
+        rkpm -> data[i] -> prev = rkps;
+        rkps -> next = rkpm -> data[i];
+    }
+    rkpm -> data[i] = rkps;
+}
+
+// 休眠的流按照多久没有活动分几轮删除，先删最久的。没有活动不到最后一轮的时间的流不删除
+static const unsigned rkpManager_shrink_idle[] = {60 * HZ, 10 * HZ, HZ};
+unsigned rkpManager_shrink(struct rkpManager* rkpm, unsigned n, struct rkpPacket** rkppl)
+{
+    unsigned long flag;
+    unsigned i, j, rtn = 0;
+    for(j = 0; j < sizeof(rkpManager_shrink_idle) / sizeof(rkpManager_shrink_idle[0]) && rtn < n; j++)
+        for(i = 0; i < 256 && rtn < n; i++)
+        {
+            struct rkpStream* rkps;
+            __rkpManager_lock(rkpm, &flag);
+            rkps = rkpm -> data[i];
+            while(rkps != 0 && rtn < n)
+            {
+                struct rkpStream* rkps2 = rkps -> next;
+                if(__rkpManager_shrinkable(rkps, rkpManager_shrink_idle[j]))
+                {
+                    __rkpManager_unlink(rkpm, i, rkps);
+                    rkpStream_delete(rkps);
+                    rkpStat_inc(shrink_evicted);
+                    rtn++;
+                }
+                rkps = rkps2;
+            }
+            __rkpManager_unlock(rkpm, flag);
+        }
+    for(i = 0; i < 256 && rtn < n; i++)
+    {
+        struct rkpStream* rkps;
+        __rkpManager_lock(rkpm, &flag);
+        for(rkps = rkpm -> data[i]; rkps != 0 && rtn < n; rkps = rkps -> next)
+            if(rkps -> cold != 0 && (rkps -> cold -> buff_scan != 0 || rkps -> cold -> buff_disordered != 0))
+            {
+                unsigned n_held = rkpPacket_num(&rkps -> cold -> buff_scan) + rkpPacket_num(&rkps -> cold -> buff_disordered);
+                rkpStream_flush(rkps, rkppl);
+                rkpStat_add(shrink_flushed, n_held);
+                rtn += n_held;
+            }
+        __rkpManager_unlock(rkpm, flag);
+    }
+    return rtn;
+}
+unsigned rkpManager_shrinkable(struct rkpManager* rkpm)
+{
+    unsigned long flag;
+    unsigned i, rtn = 0;
+    const struct rkpStream* rkps;
+    for(i = 0; i < 256; i++)
+    {
+        __rkpManager_lock(rkpm, &flag);
+        for(rkps = rkpm -> data[i]; rkps != 0; rkps = rkps -> next)
+            rtn += __rkpManager_shrinkable(rkps, rkpManager_shrink_idle[sizeof(rkpManager_shrink_idle) / sizeof(rkpManager_shrink_idle[0]) - 1]);
+        __rkpManager_unlock(rkpm, flag);
+    }
+    return rtn;
+}
+bool __rkpManager_shrinkable(const struct rkpStream* rkps, unsigned idle)
+{
+    // 只删除停在请求边界上的流。在 body 中或者在等待 psh 的流被删掉后，下一个包会被新的流当作请求的开头扫描，可能改掉 body 中的内容
+    return rkps -> cold == 0 && rkps -> status == __rkpStream_sniffing_uaBegin && (u_int32_t)jiffies - rkps -> last_active >= idle;
+}
+void __rkpManager_unlink(struct rkpManager* rkpm, unsigned i, struct rkpStream* rkps)
+{
+    if(rkps -> prev != 0)
+        rkps -> prev -> next = rkps -> next;
+    if(rkps -> next != 0)
+        rkps -> next -> prev = rkps -> prev;
+    if(rkps == rkpm -> data[i])
+        rkpm -> data[i] = rkps -> next;
+    rkps -> prev = rkps -> next = 0;
 }
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4,14,0)
@@ -127,8 +406,6 @@ void __rkpManager_refresh(struct timer_list* timer)
     unsigned i;
     unsigned long flag;
 
-    if(debug)
-        printk("rkpManager_refresh\n");
     __rkpManager_lock(rkpm, &flag);
     for(i = 0; i < 256; i++)
     {
@@ -137,12 +414,7 @@ void __rkpManager_refresh(struct timer_list* timer)
             if(!rkps -> active)
             {
                 struct rkpStream *rkps2 = rkps -> next;
-                if(rkps -> prev != 0)
-                    rkps -> prev -> next = rkps -> next;
-                if(rkps -> next != 0)
-                    rkps -> next -> prev = rkps -> prev;
-                if(rkps == rkpm -> data[i])
-                    rkpm -> data[i] = rkps -> next;
+                __rkpManager_unlink(rkpm, i, rkps);
                 rkpStream_delete(rkps);
                 rkps = rkps2;
             }
@@ -157,11 +429,84 @@ void __rkpManager_refresh(struct timer_list* timer)
     __rkpManager_unlock(rkpm, flag);
 }
 
+void __rkpManager_hold(struct rkpManager* rkpm, struct rkpStream* rkps)
+{
+    if(time_hold == 0 || rkps -> cold == 0 || (rkps -> cold -> buff_scan == 0 && rkps -> cold -> buff_disordered == 0))
+        return;
+    if(list_empty(&rkps -> cold -> held))
+        list_add_tail(&rkps -> cold -> held, &rkpm -> held);
+    // 定时器已经在等待的话，它的时间一定不晚于刚刚截留的包到期的时间
+    if(!hrtimer_is_queued(__rkpManager_hold_timer(rkpm)))
+        __rkpManager_hold_start(rkpm, rkpStream_holdSince(rkps) + (u_int64_t)time_hold * NSEC_PER_MSEC);
+}
+enum hrtimer_restart __rkpManager_hold_expire(struct hrtimer* timer)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+    struct rkpManager* rkpm = container_of(timer, struct rkpManager, hold_timer.timer);
+#else
+    struct rkpManager* rkpm = container_of(timer, struct rkpManager, hold_timer);
+#endif
+    struct rkpStream_cold *cold, *cold2;
+    struct rkpPacket* rkppl = 0;
+    struct rkpStat __percpu* stat_outer;
+    u_int64_t now = ktime_get_ns(), next = 0;
+    unsigned long flag;
+
+    __rkpManager_lock(rkpm, &flag);
+    list_for_each_entry_safe(cold, cold2, &rkpm -> held, held)
+    {
+        struct rkpStream* rkps = cold -> stream;
+        u_int64_t since = rkpStream_holdSince(rkps);
+        if(since == 0)
+            list_del_init(&cold -> held);
+        else if(now - since >= (u_int64_t)time_hold * NSEC_PER_MSEC)
+        {
+            // flush 会释放 cold，同时把它从链表中取下
+            rkpStat_add(hold_expired, rkpPacket_num(&cold -> buff_scan) + rkpPacket_num(&cold -> buff_disordered));
+            rkpStream_flush(rkps, &rkppl);
+        }
+        else if(next == 0 || since + (u_int64_t)time_hold * NSEC_PER_MSEC < next)
+            next = since + (u_int64_t)time_hold * NSEC_PER_MSEC;
+    }
+    // 在锁中重新启动，这样 __rkpManager_hold 看到的定时器状态总是和链表一致
+    if(next != 0)
+        __rkpManager_hold_start(rkpm, next);
+    __rkpManager_unlock(rkpm, flag);
+    // 在软中断中，不会换 CPU。放出的包仍然记在这个命名空间中
+    stat_outer = rkpStat_enter(rkpm -> stat);
+    rkpPacket_sendl(&rkppl);
+    rkpStat_leave(stat_outer);
+    return HRTIMER_NORESTART;
+}
+struct hrtimer* __rkpManager_hold_timer(struct rkpManager* rkpm)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+    return &rkpm -> hold_timer.timer;
+#else
+    return &rkpm -> hold_timer;
+#endif
+}
+void __rkpManager_hold_start(struct rkpManager* rkpm, u_int64_t ns)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+    tasklet_hrtimer_start(&rkpm -> hold_timer, ns_to_ktime(ns), HRTIMER_MODE_ABS);
+#else
+    hrtimer_start(&rkpm -> hold_timer, ns_to_ktime(ns), HRTIMER_MODE_ABS_SOFT);
+#endif
+}
+
 void __rkpManager_lock(struct rkpManager* rkpm, unsigned long* flagp)
 {
+    u_int64_t t = rkpStat_stage_begin();
     spin_lock_irqsave(&rkpm -> lock, *flagp);
+    rkpStat_stage_end(rkpStat_stage_lockWait, t);
+    rkpm -> lock_begin = rkpStat_stage_begin();
+    rkpm -> stat_outer = rkpStat_enter(rkpm -> stat);
 }
 void __rkpManager_unlock(struct rkpManager* rkpm, unsigned long flag)
 {
+    u_int64_t t = rkpm -> lock_begin;
+    rkpStat_leave(rkpm -> stat_outer);
     spin_unlock_irqrestore(&rkpm -> lock, flag);
+    rkpStat_stage_end(rkpStat_stage_lockHold, t);
 }
\ No newline at end of file
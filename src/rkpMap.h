@@ -6,10 +6,11 @@ struct rkpMap
 {
     int32_t begin, length;                  // begin 为绝对序列号
     // int32_t &seq_offset = beign;         // 需要一个差不多的数值作为偏移来计算序列号谁先谁后的问题，这个偏移取为 begin
+    u_int8_t rule;                          // 按哪一条规则（见 rkpRule.h）替换
     struct rkpMap *prev, *next;
 };
 
-struct rkpMap* rkpMap_new(int32_t, int32_t);                    // 两个参数分别为起始和终止绝对序列号
+struct rkpMap* rkpMap_new(int32_t, int32_t, unsigned);          // 参数分别为起始和终止绝对序列号，以及规则
 void rkpMap_delete(struct rkpMap*);
 
 unsigned char __rkpMap_map(const struct rkpMap*, int32_t);      // 返回某个序列号对应的映射后的值。假定参数是合法的。这里的参数是相对序列号
@@ -19,13 +20,14 @@ void rkpMap_insert_begin(struct rkpMap**, struct rkpMap*);      // 在开头位
 void rkpMap_insert_end(struct rkpMap**, struct rkpMap*);
 void rkpMap_refresh(struct rkpMap**, int32_t);                  // 对于一列序列号递增的映射，删除已经回应的映射
 
-struct rkpMap* rkpMap_new(int32_t seql, int32_t seqr)
+struct rkpMap* rkpMap_new(int32_t seql, int32_t seqr, unsigned rule)
 {
     struct rkpMap* rkpm = (struct rkpMap*)rkpMalloc(sizeof(struct rkpMap));
     if(rkpm == 0)
         return 0;
     rkpm -> begin = seql;
     rkpm -> length = seqr - seql;
+    rkpm -> rule = rule;
     rkpm -> prev = rkpm -> next = 0;
     return rkpm;
 }
@@ -36,14 +38,12 @@ void rkpMap_delete(struct rkpMap* rkpm)
 
 unsigned char __rkpMap_map(const struct rkpMap* rkpm, int32_t seq)
 {
-    if(seq < strlen(str_uaRkp))
-        return str_uaRkp[seq];
-    else 
-        return ' ';
+    return rkpRule_map(rkpm -> rule, seq);
 }
 void rkpMap_modify(struct rkpMap** rkpml, struct rkpPacket** rkppl)
 {
     const struct rkpMap* rkpm;
+    u_int64_t t = rkpStat_stage_begin();
     for(rkpm = *rkpml; rkpm != 0; rkpm = rkpm -> next)
     {
         struct rkpPacket* rkpp;
@@ -52,7 +52,7 @@ void rkpMap_modify(struct rkpMap** rkpml, struct rkpPacket** rkppl)
 
         // 尝试确定第一个需要修改的包以及需要修改的开始处
         for(rkpp = *rkppl; rkpp != 0; rkpp = rkpp -> next)
-            if(rkpPacket_seq(rkpp, rkpm -> begin) + rkpPacket_appLen(rkpp) > 0)
+            if(rkpPacket_seq(rkpp, rkpm -> begin) + (int32_t)rkpPacket_appLen(rkpp) > 0)
                 break;
         if(rkpp == 0)
             break;
@@ -72,10 +72,12 @@ void rkpMap_modify(struct rkpMap** rkpml, struct rkpPacket** rkppl)
             for(; p != rkpPacket_appEnd(rkpp) && seq < rkpm -> length; p++, seq++)
                 *p = __rkpMap_map(rkpm, seq);
             rkpPacket_csum(rkpp);
+            trace_rkp_map_modify(rkpm -> begin, rkpm -> length, rkpPacket_seq(rkpp, 0), rkpPacket_appLen(rkpp));
             if(seq == rkpm -> length)
                 break;
         }
     }
+    rkpStat_stage_end(rkpStat_stage_modify, t);
 }
 
 void rkpMap_insert_begin(struct rkpMap** rkpml, struct rkpMap* rkpm)
@@ -87,6 +89,8 @@ void rkpMap_insert_begin(struct rkpMap** rkpml, struct rkpMap* rkpm)
 }
 void rkpMap_insert_end(struct rkpMap** rkpml, struct rkpMap* rkpm)
 {
+    if(rkpm == 0)           // rkpMap_new 可能失败，这时就不修改了
+        return;
     if(*rkpml == 0)
         *rkpml = rkpm;
     else
@@ -0,0 +1,63 @@
+#pragma once
+#include "common.h"
+
+// 模块占用内存的全局预算，包括截留的 skb 的 truesize 和所有 rkpMalloc 分配的对象。
+// 使用量用 percpu_counter 记录，读取时只取近似值，不会在每个包上把所有 CPU 的计数加一遍。
+static struct percpu_counter rkpMem_used;
+#define rkpMem_batch (64 * 1024)
+
+int rkpMem_init(void);
+void rkpMem_exit(void);
+
+void rkpMem_charge(long);                   // 记录内存使用量的变化，单位为字节
+bool rkpMem_near(void);                     // 是否接近预算（超过 7/8）。接近预算时新的流直接放行，不再追踪
+bool rkpMem_over(void);                     // 是否已经超过预算。超过预算时不再截留包，而是把已经截留的包放出去
+
+void* rkpMalloc(unsigned);
+void rkpFree(void*);
+
+int rkpMem_init(void)
+{
+    return percpu_counter_init(&rkpMem_used, 0, GFP_KERNEL);
+}
+void rkpMem_exit(void)
+{
+    percpu_counter_destroy(&rkpMem_used);
+}
+
+void rkpMem_charge(long n)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0)
+    percpu_counter_add_batch(&rkpMem_used, n, rkpMem_batch);
+#else
+    __percpu_counter_add(&rkpMem_used, n, rkpMem_batch);
+#endif
+}
+bool rkpMem_near(void)
+{
+    return mem_budget != 0 && percpu_counter_read_positive(&rkpMem_used) >= (s64)mem_budget * 1024 / 8 * 7;
+}
+bool rkpMem_over(void)
+{
+    return mem_budget != 0 && percpu_counter_read_positive(&rkpMem_used) >= (s64)mem_budget * 1024;
+}
+
+void* rkpMalloc(unsigned size)
+{
+    void* p = kmalloc(size, GFP_NOWAIT);
+    if(p == 0)
+    {
+        rkpStat_inc(malloc_failed);
+        if(static_branch_unlikely(&rkpSetting_debug))
+            printk("rkp-ua: malloc failed.\n");
+    }
+    else
+        rkpMem_charge(ksize(p));
+    return p;
+}
+void rkpFree(void* p)
+{
+    if(p != 0)
+        rkpMem_charge(-(long)ksize(p));
+    kfree(p);
+}
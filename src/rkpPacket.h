@@ -9,6 +9,8 @@ struct rkpPacket
     u_int8_t sid;
     u_int32_t lid[3];
     bool ack;
+    u_int8_t hold_reason;               // 被截留的原因，由截留它的人在放入链表之前设置，默认是 rkpStat_hold_scan
+    u_int64_t hold_time;                // 开始截留的时间，单位为纳秒
 };
 
 struct rkpPacket* rkpPacket_new(struct sk_buff*, bool);
@@ -28,6 +30,8 @@ u_int16_t rkpPacket_dport(const struct rkpPacket*);
 bool rkpPacket_psh(const struct rkpPacket*);
 bool rkpPacket_syn(const struct rkpPacket*);
 bool rkpPacket_ack(const struct rkpPacket*);
+bool rkpPacket_fin(const struct rkpPacket*);
+bool rkpPacket_rst(const struct rkpPacket*);
 
 void rkpPacket_csum(struct rkpPacket*);
 bool __rkpPacket_makeWriteable(struct rkpPacket*);
@@ -41,6 +45,9 @@ struct rkpPacket* rkpPacket_pop_begin(struct rkpPacket**);              // 将
 struct rkpPacket* rkpPacket_pop_end(struct rkpPacket**);                // 将指定链表尾部的包取出
 unsigned rkpPacket_num(struct rkpPacket**);                       // 返回指定链表中包的数目
 
+void __rkpPacket_hold(struct rkpPacket*);                        // 包被放进链表（即被截留）时计数并记下时间
+void __rkpPacket_unhold(struct rkpPacket*);                      // 包被从链表中取出时计数，并记录截留的时长
+
 void rkpPacket_sendl(struct rkpPacket**);
 void rkpPacket_deletel(struct rkpPacket**);
 void rkpPacket_dropl(struct rkpPacket**);
@@ -53,6 +60,7 @@ struct rkpPacket* rkpPacket_new(struct sk_buff* skb, bool ack)
     rkpp -> prev = rkpp -> next = 0;
     rkpp -> skb = skb;
     rkpp -> ack = ack;
+    rkpp -> hold_reason = rkpStat_hold_scan;
     rkpp -> sid = (rkpPacket_sport(rkpp) + rkpPacket_dport(rkpp)) & 0xFF;
     if(!ack)
     {
@@ -75,12 +83,15 @@ struct rkpPacket* rkpPacket_new(struct sk_buff* skb, bool ack)
 }
 void rkpPacket_send(struct rkpPacket* rkpp)
 {
+    u_int64_t t = rkpStat_stage_begin();
     if(dev_queue_xmit(rkpp -> skb))
     {
-        printk("rkp-ua: rkpPacket_new: Send failed. Drop it.\n");
+        if(static_branch_unlikely(&rkpSetting_debug))
+            printk("rkp-ua: rkpPacket_new: Send failed. Drop it.\n");
         kfree_skb(rkpp -> skb);
     }
     rkpFree(rkpp);
+    rkpStat_stage_end(rkpStat_stage_send, t);
 }
 void rkpPacket_delete(struct rkpPacket* rkpp)
 {
@@ -140,16 +151,26 @@ bool rkpPacket_ack(const struct rkpPacket* rkpp)
 {
     return tcp_hdr(rkpp -> skb) -> ack;
 }
+bool rkpPacket_fin(const struct rkpPacket* rkpp)
+{
+    return tcp_hdr(rkpp -> skb) -> fin;
+}
+bool rkpPacket_rst(const struct rkpPacket* rkpp)
+{
+    return tcp_hdr(rkpp -> skb) -> rst;
+}
 
 void rkpPacket_csum(struct rkpPacket* rkpp)
 {
     struct iphdr* iph = ip_hdr(rkpp -> skb);
     struct tcphdr* tcph = tcp_hdr(rkpp -> skb);
+    u_int64_t t = rkpStat_stage_begin();
     tcph -> check = 0;
     iph -> check = 0;
     rkpp -> skb -> csum = skb_checksum(rkpp -> skb, iph -> ihl * 4, ntohs(iph -> tot_len) - iph -> ihl * 4, 0);
     iph -> check = ip_fast_csum((unsigned char*)iph, iph -> ihl);
     tcph -> check = csum_tcpudp_magic(iph -> saddr, iph -> daddr, ntohs(iph -> tot_len) - iph -> ihl * 4, IPPROTO_TCP, rkpp -> skb -> csum);
+    rkpStat_stage_end(rkpStat_stage_csum, t);
 }
 
 bool __rkpPacket_makeWriteable(struct rkpPacket* rkpp)
@@ -160,7 +181,8 @@ bool __rkpPacket_makeWriteable(struct rkpPacket* rkpp)
 	if(!skb_make_writable(rkpp -> skb, rkpPacket_appEnd(rkpp)- (unsigned char*)rkpp -> skb -> data) || rkpp -> skb -> data == 0)
 #endif
     {
-        printk("rkp-ua: rkpPacket_makeWriteable: failed.\n");
+        if(static_branch_unlikely(&rkpSetting_debug))
+            printk("rkp-ua: rkpPacket_makeWriteable: failed.\n");
         return false;
     }
     return true;
@@ -173,6 +195,7 @@ void rkpPacket_makeOffset(const struct rkpPacket* rkpp, int32_t* offsetp)
 
 void rkpPacket_insert_auto(struct rkpPacket** buff, struct rkpPacket* rkpp, int32_t offset)
 {
+    __rkpPacket_hold(rkpp);
     // 如果链表是空的，那么就直接加进去
     if(*buff == 0)
         *buff = rkpp;
@@ -198,6 +221,7 @@ void rkpPacket_insert_auto(struct rkpPacket** buff, struct rkpPacket* rkpp, int3
 }
 void rkpPacket_insert_begin(struct rkpPacket** buff, struct rkpPacket* rkpp)
 {
+    __rkpPacket_hold(rkpp);
     if(*buff == 0)
         *buff = rkpp;
     else
@@ -209,6 +233,7 @@ void rkpPacket_insert_begin(struct rkpPacket** buff, struct rkpPacket* rkpp)
 }
 void rkpPacket_insert_end(struct rkpPacket** buff, struct rkpPacket* rkpp)
 {
+    __rkpPacket_hold(rkpp);
     if(*buff == 0)
         *buff = rkpp;
     else
@@ -231,6 +256,7 @@ struct rkpPacket* rkpPacket_pop_begin(struct rkpPacket** buff)
         rkpp -> next = 0;
         (*buff) -> prev = 0;
     }
+    __rkpPacket_unhold(rkpp);
     return rkpp;
 }
 struct rkpPacket* rkpPacket_pop_end(struct rkpPacket** buff)
@@ -245,6 +271,7 @@ struct rkpPacket* rkpPacket_pop_end(struct rkpPacket** buff)
         rkpp -> prev -> next = 0;
         rkpp -> prev = 0;
     }
+    __rkpPacket_unhold(rkpp);
     return rkpp;
 }
 unsigned rkpPacket_num(struct rkpPacket** buff)
@@ -265,6 +292,7 @@ void rkpPacket_sendl(struct rkpPacket** rkppl)
     while(rkpp != 0)
     {
         rkpp2 = rkpp -> next;
+        __rkpPacket_unhold(rkpp);
         rkpPacket_send(rkpp);
         rkpp = rkpp2;
     }
@@ -276,6 +304,7 @@ void rkpPacket_deletel(struct rkpPacket** rkppl)
     while(rkpp != 0)
     {
         rkpp2 = rkpp -> next;
+        __rkpPacket_unhold(rkpp);
         rkpPacket_delete(rkpp);
         rkpp = rkpp2;
     }
@@ -287,8 +316,25 @@ void rkpPacket_dropl(struct rkpPacket** rkppl)
     while(rkpp != 0)
     {
         rkpp2 = rkpp -> next;
+        __rkpPacket_unhold(rkpp);
         rkpPacket_drop(rkpp);
         rkpp = rkpp2;
     }
     *rkppl = 0;
+}
+
+void __rkpPacket_hold(struct rkpPacket* rkpp)
+{
+    rkpp -> hold_time = ktime_get_ns();
+    rkpStat_inc(packets_held);
+    rkpStat_add(bytes_held, rkpp -> skb -> truesize);
+    rkpMem_charge(rkpp -> skb -> truesize);
+}
+void __rkpPacket_unhold(struct rkpPacket* rkpp)
+{
+    rkpStat_sub(packets_held, 1);
+    rkpStat_sub(bytes_held, rkpp -> skb -> truesize);
+    rkpMem_charge(-(long)rkpp -> skb -> truesize);
+    rkpStat_hold_record(rkpp -> hold_reason, ktime_get_ns() - rkpp -> hold_time);
+    rkpp -> hold_reason = rkpStat_hold_scan;
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+#include "common.h"
+
+// 飞行记录器：每个流上的每个决定都写一条定长的二进制记录到 relay 的通道中，每个 CPU 一个缓冲区，写满后覆盖最旧的记录。
+// 通道由 xmurp-ua.c 在 debugfs 的 xmurp-ua 目录下创建（文件为 record0、record1……，每个 CPU 一个），用户态用 tools/rkpRecord 解码。
+// relay_write 只关本地中断、写本 CPU 的缓冲区，不需要加锁，所以可以一直开着。内核没有 CONFIG_RELAY 时不记录。
+enum
+{
+    rkpRecord_event_execute,                    // rkpStream_execute 处理了一个包
+    rkpRecord_event_new,                        // 新建了一个流。seq、map_begin 为客户端和服务端的地址，len、map_length 为两端的端口
+    rkpRecord_event_delete,                     // 删除了一个流
+    rkpRecord_event_flush                       // 放弃截留（超时、超过内存预算或者 shrinker），n_map 为放出的包数
+};
+enum
+{
+    rkpRecord_flag_ack = 1,                     // 服务端发回的 ack，seq 为确认号
+    rkpRecord_flag_psh = 2
+};
+
+struct rkpRecord
+// 一条记录，固定 32 字节，子缓冲区的大小是它的整数倍，这样 relay 不会在记录之间插入填充。字段都是本机字节序
+{
+    u_int64_t time;                             // ktime_get_ns
+    u_int32_t flow;                             // 流的哈希，见 rkpRecord_hash
+    u_int32_t seq;                              // 包的绝对序列号
+    u_int32_t map_begin;                        // 处理这个包时新生成的最后一个映射的开始（绝对序列号）
+    u_int16_t len;                              // 包的应用层长度
+    u_int16_t map_length;                       // 新生成的最后一个映射的长度，没有时为 0
+    u_int8_t event, flags;
+    u_int8_t status_before, status_after;       // 处理前后流的状态
+    u_int8_t scan_before, scan_after;           // 处理前后的 scan_status，没有 cold 时为 noFound
+    u_int8_t verdict;
+    u_int8_t n_map;                             // 处理这个包时新生成的映射的个数
+};
+static_assert(sizeof(struct rkpRecord) == 32, "rkpRecord must be 32 bytes.");
+
+static struct rchan* rkpRecord_chan;            // 由 xmurp-ua.c（或者用户态的 rkpLib）打开，同时打开 rkpSetting_record
+// 正在生成的 execute 记录，生成映射时填入其中。处理乱序的包时 rkpStream_execute 会递归调用，每一层都先保存外层的再恢复。
+// 整个过程都持有 rkpManager 的锁并关闭了中断，不会被打断
+static DEFINE_PER_CPU(struct rkpRecord*, rkpRecord_current);
+
+u_int32_t rkpRecord_hash(const u_int32_t*);     // 由流的 id 计算哈希
+void rkpRecord_write(struct rkpRecord*);        // 填入时间后写入本 CPU 的缓冲区，其它字段由调用者填好
+void rkpRecord_map(u_int32_t, u_int32_t);       // 生成了一个映射，参数为开始的绝对序列号和长度
+void rkpRecord_stream(u_int8_t, const u_int32_t*, u_int8_t);
+        // 记录流的建立、删除和放弃截留，参数为事件、流的 id 和（放弃截留时）放出的包数
+
+u_int32_t rkpRecord_hash(const u_int32_t* id)
+{
+    u_int32_t h = id[0] * 0x9E3779B1U;
+    h = (h ^ (h >> 15) ^ id[1]) * 0x85EBCA77U;
+    h = (h ^ (h >> 13) ^ id[2]) * 0xC2B2AE3DU;
+    return h ^ (h >> 16);
+}
+void rkpRecord_write(struct rkpRecord* rkpr)
+{
+#ifdef CONFIG_RELAY
+    rkpr -> time = ktime_get_ns();
+    relay_write(rkpRecord_chan, rkpr, sizeof(struct rkpRecord));
+#endif
+}
+void rkpRecord_map(u_int32_t begin, u_int32_t length)
+{
+    struct rkpRecord* rkpr = this_cpu_read(rkpRecord_current);
+    if(rkpr == 0)
+        return;
+    rkpr -> map_begin = begin;
+    rkpr -> map_length = length;
+    if(rkpr -> n_map != 0xFF)
+        rkpr -> n_map++;
+}
+void rkpRecord_stream(u_int8_t event, const u_int32_t* id, u_int8_t n)
+{
+    struct rkpRecord rkpr;
+    memset(&rkpr, 0, sizeof(struct rkpRecord));
+    rkpr.flow = rkpRecord_hash(id);
+    rkpr.event = event;
+    rkpr.n_map = n;
+    if(event == rkpRecord_event_new)
+    {
+        rkpr.seq = id[0];
+        rkpr.map_begin = id[1];
+        rkpr.len = id[2] >> 16;
+        rkpr.map_length = id[2] & 0xFFFF;
+    }
+    rkpRecord_write(&rkpr);
+}
@@ -0,0 +1,248 @@
+#pragma once
+#include "common.h"
+
+// 请求头的改写规则。每条规则把一个请求头的值换成等长的内容：替换值比原来的值短时用空格补齐，长时截断；值中包含这条规则的保留列表中的任何一个字符串时不修改。
+// 第 0 条规则是 User-Agent，替换值为 str_uaRkp，保留列表为 str_preserve；其余的规则来自模块参数 str_rule，每条的格式为“名称=替换值|保留1|保留2……”。
+// 加载时把所有规则的名称，连同 http 头的结尾和确定 body 长度要用的 Content-Length、Transfer-Encoding，编译成一个自动机，
+// __rkpStream_scan 在头部中每个字节只查一次表，规则再多也只扫描一遍。名称不区分大小写，必须在一行的开头（\r\n 之后），后面紧跟冒号。
+#define rkpRule_max (1 + sizeof(str_rule) / sizeof(str_rule[0]))
+#define rkpRule_preserve_max 16                 // str_rule 中每条规则的保留列表最长有多少项
+#define rkpRule_len_name 64                     // 名称最长有多少个字节
+
+struct rkpRule
+{
+    const char* name;                           // 头部的名称，不包括冒号
+    const unsigned char* replace;
+    unsigned len_replace;
+    char** preserve;
+    unsigned n_preserve;
+    char* buff;                                 // str_rule 中的规则复制一份再切开，name、replace 和 preserve 都指向这里。第 0 条规则为 0
+    char* buff_preserve[rkpRule_preserve_max];
+};
+static struct rkpRule rkpRule_rules[rkpRule_max];
+static unsigned rkpRule_n;                      // 规则的个数，包括 User-Agent
+static unsigned rkpRule_n_preserve;             // 最长的保留列表的长度，rkpStream_cold 中的 scan_uaPreserve_matched 按它分配
+
+enum
+// 自动机匹配到了什么，由 __rkpStream_scan_head 返回。匹配到第 i 条规则的名称（包括冒号）时为 rkpRule_match_rule + i
+{
+    rkpRule_match_none,
+    rkpRule_match_headEnd,
+    rkpRule_match_contentLength,
+    rkpRule_match_transferEncoding,
+    rkpRule_match_rule
+};
+enum
+// 编号固定的几个状态
+{
+    rkpRule_state_root,                         // 初始状态，也是在一行中间时的状态
+    rkpRule_state_cr,                           // 刚匹配了 \r
+    rkpRule_state_lineBegin                     // 刚匹配了 \r\n，即一行的开头
+};
+// 状态转移表。状态都用它在表中的那一行的开头（即编号 * rkpRule_n_class）表示，下一个状态为 rkpRule_next[状态 + rkpRule_class[字节]]，每个字节省掉一次乘法。
+// 不在任何名称中出现的字节都属于类 0，大写和小写字母属于同一类，这样表很小（通常只有几 KB），可以一直留在缓存中。
+// 编号不小于 rkpRule_state_match 的状态表示匹配到了什么，匹配到 rkpRule_match_xxx 时编号为 rkpRule_state_match + rkpRule_match_xxx - 1
+static u_int8_t rkpRule_class[256];
+static u_int16_t* rkpRule_next;
+static unsigned rkpRule_n_class, rkpRule_n_state, rkpRule_state_match;
+#define rkpRule_offset(state) ((state) * rkpRule_n_class)     // 编号为 state 的状态在表中的表示
+
+int rkpRule_init(void);                         // 解析 str_rule 并编译自动机，需要在设置好 str_uaRkp 之后调用。规则有误时返回 -EINVAL
+void rkpRule_exit(void);
+unsigned char rkpRule_map(unsigned, unsigned);  // 返回某条规则替换后的值中某个偏移处的字节
+
+int __rkpRule_parse(struct rkpRule*, const char*);
+unsigned __rkpRule_keyword(unsigned, unsigned char*);
+        // 将自动机的第几个关键字（去掉开头的 \r\n）转成小写写入第二个参数，返回长度。关键字依次为 headEnd、Content-Length、Transfer-Encoding 和各条规则
+int __rkpRule_compile(void);
+
+int rkpRule_init(void)
+{
+    unsigned i;
+    int ret;
+    rkpRule_rules[0].name = "User-Agent";
+    rkpRule_rules[0].replace = str_uaRkp;
+    rkpRule_rules[0].len_replace = strlen(str_uaRkp);
+    rkpRule_rules[0].preserve = str_preserve;
+    rkpRule_rules[0].n_preserve = n_str_preserve;
+    rkpRule_rules[0].buff = 0;
+    rkpRule_n = 1;
+    rkpRule_n_preserve = n_str_preserve;
+    for(i = 0; i < n_str_rule; i++)
+    {
+        ret = __rkpRule_parse(&rkpRule_rules[rkpRule_n], str_rule[i]);
+        if(ret)
+        {
+            printk("rkp-ua: bad rule: %s\n", str_rule[i]);
+            rkpRule_exit();
+            return ret;
+        }
+        if(rkpRule_rules[rkpRule_n].n_preserve > rkpRule_n_preserve)
+            rkpRule_n_preserve = rkpRule_rules[rkpRule_n].n_preserve;
+        rkpRule_n++;
+    }
+    ret = __rkpRule_compile();
+    if(ret)
+        rkpRule_exit();
+    return ret;
+}
+void rkpRule_exit(void)
+{
+    unsigned i;
+    for(i = 1; i < rkpRule_n; i++)
+        kfree(rkpRule_rules[i].buff);
+    rkpRule_n = 0;
+    kfree(rkpRule_next);
+    rkpRule_next = 0;
+}
+unsigned char rkpRule_map(unsigned rule, unsigned pos)
+{
+    if(pos < rkpRule_rules[rule].len_replace)
+        return rkpRule_rules[rule].replace[pos];
+    else
+        return ' ';
+}
+
+int __rkpRule_parse(struct rkpRule* rule, const char* str)
+{
+    char *p, *q;
+    rule -> buff = kstrdup(str, GFP_KERNEL);
+    if(rule -> buff == 0)
+        return -ENOMEM;
+    // 名称只能由可见字符组成，不能有冒号
+    for(p = rule -> buff; *p != '=' && *p != 0; p++)
+        if(*p <= ' ' || *p >= 0x7F || *p == ':')
+            break;
+    if(*p != '=' || p == rule -> buff || p - rule -> buff > rkpRule_len_name)
+    {
+        kfree(rule -> buff);
+        return -EINVAL;
+    }
+    *p = 0;
+    rule -> name = rule -> buff;
+    rule -> replace = p + 1;
+    rule -> preserve = rule -> buff_preserve;
+    rule -> n_preserve = 0;
+    for(q = p + 1; *q != 0; q++)
+        if(*q == '|')
+        {
+            *q = 0;
+            if(rule -> n_preserve == rkpRule_preserve_max)
+            {
+                kfree(rule -> buff);
+                return -EINVAL;
+            }
+            rule -> preserve[rule -> n_preserve++] = q + 1;
+        }
+    rule -> len_replace = strlen(rule -> replace);
+    return 0;
+}
+unsigned __rkpRule_keyword(unsigned k, unsigned char* buff)
+{
+    const char* name;
+    unsigned len;
+    if(k == rkpRule_match_headEnd - 1)
+    {
+        memcpy(buff, "\r\n", 2);
+        return 2;
+    }
+    else if(k == rkpRule_match_contentLength - 1)
+        name = "Content-Length";
+    else if(k == rkpRule_match_transferEncoding - 1)
+        name = "Transfer-Encoding";
+    else
+        name = rkpRule_rules[k - (rkpRule_match_rule - 1)].name;
+    for(len = 0; name[len] != 0; len++)
+        buff[len] = name[len] >= 'A' && name[len] <= 'Z' ? name[len] - 'A' + 'a' : name[len];
+    buff[len++] = ':';
+    return len;
+}
+int __rkpRule_compile(void)
+// 所有的关键字都以 \r\n 开头，并且除了 headEnd 以外，开头之后都不再有 \r。于是在任何状态下遇到不能继续匹配的字节时，
+// 能匹配的最长的后缀要么是刚遇到的 \r（转到 rkpRule_state_cr），要么什么都没有（转到 rkpRule_state_root），不需要一般的 Aho-Corasick 的失败指针。
+// 先用 int16_t 的临时表建出关键字的字典树（匹配完一个关键字的转移记为 -2 - 关键字的编号），再补上失败的转移，换成最终的表示
+{
+    unsigned n_keyword = rkpRule_match_rule - 1 + rkpRule_n, n_node = 3, max_node = 3, k, i, c;
+    unsigned char buff[rkpRule_len_name + 1];
+    int16_t* trie;
+    int ret = 0;
+
+    // 划分字节的类
+    memset(rkpRule_class, 0, sizeof(rkpRule_class));
+    rkpRule_n_class = 1;
+    rkpRule_class['\r'] = rkpRule_n_class++;
+    rkpRule_class['\n'] = rkpRule_n_class++;
+    for(k = 0; k < n_keyword; k++)
+    {
+        unsigned len = __rkpRule_keyword(k, buff);
+        max_node += len;
+        for(i = 0; i < len; i++)
+            if(rkpRule_class[buff[i]] == 0)
+            {
+                rkpRule_class[buff[i]] = rkpRule_n_class;
+                if(buff[i] >= 'a' && buff[i] <= 'z')
+                    rkpRule_class[buff[i] - 'a' + 'A'] = rkpRule_n_class;
+                rkpRule_n_class++;
+            }
+    }
+
+    // 建字典树
+    trie = kmalloc(sizeof(int16_t) * max_node * rkpRule_n_class, GFP_KERNEL);
+    if(trie == 0)
+        return -ENOMEM;
+    for(i = 0; i < max_node * rkpRule_n_class; i++)
+        trie[i] = -1;
+    trie[rkpRule_state_root * rkpRule_n_class + rkpRule_class['\r']] = rkpRule_state_cr;
+    trie[rkpRule_state_cr * rkpRule_n_class + rkpRule_class['\n']] = rkpRule_state_lineBegin;
+    for(k = 0; k < n_keyword; k++)
+    {
+        unsigned len = __rkpRule_keyword(k, buff), node = rkpRule_state_lineBegin;
+        for(i = 0; i + 1 < len; i++)
+        {
+            int16_t* next = &trie[node * rkpRule_n_class + rkpRule_class[buff[i]]];
+            if(*next == -1)
+                *next = n_node++;
+            node = *next;
+        }
+        // 名称重复（包括与 User-Agent、Content-Length、Transfer-Encoding 重复）
+        if(trie[node * rkpRule_n_class + rkpRule_class[buff[len - 1]]] != -1)
+        {
+            printk("rkp-ua: duplicate rule: %s\n", rkpRule_rules[k - (rkpRule_match_rule - 1)].name);
+            ret = -EINVAL;
+            goto out;
+        }
+        trie[node * rkpRule_n_class + rkpRule_class[buff[len - 1]]] = -2 - k;
+    }
+    rkpRule_state_match = n_node;
+    rkpRule_n_state = n_node + n_keyword;
+    if(rkpRule_n_state * rkpRule_n_class > 0xFFFF)
+    {
+        printk("rkp-ua: too many rules.\n");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    // 换成最终的表。匹配完一个关键字之后的状态和 root 一样
+    rkpRule_next = kmalloc(sizeof(u_int16_t) * rkpRule_n_state * rkpRule_n_class, GFP_KERNEL);
+    if(rkpRule_next == 0)
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
+    for(i = 0; i < rkpRule_n_state; i++)
+        for(c = 0; c < rkpRule_n_class; c++)
+        {
+            int16_t next = i < n_node ? trie[i * rkpRule_n_class + c] : -1;
+            if(next >= 0)
+                rkpRule_next[i * rkpRule_n_class + c] = rkpRule_offset(next);
+            else if(next <= -2)
+                rkpRule_next[i * rkpRule_n_class + c] = rkpRule_offset(rkpRule_state_match - 2 - next);
+            else if(c == rkpRule_class['\r'])
+                rkpRule_next[i * rkpRule_n_class + c] = rkpRule_offset(rkpRule_state_cr);
+            else
+                rkpRule_next[i * rkpRule_n_class + c] = rkpRule_offset(rkpRule_state_root);
+        }
+out:
+    kfree(trie);
+    return ret;
+}
@@ -9,6 +9,9 @@ module_param(autocapture, bool, 0);
 static char* str_preserve[128];
 static unsigned n_str_preserve = 0;
 module_param_array(str_preserve, charp, &n_str_preserve, 0);
+static char* str_rule[15];                      // 除 User-Agent 以外的改写规则，格式见 rkpRule.h
+static unsigned n_str_rule = 0;
+module_param_array(str_rule, charp, &n_str_rule, 0);
 static unsigned mark_capture = 0x100;
 module_param(mark_capture, uint, 0);
 static unsigned mark_ack = 0x200;
@@ -17,10 +20,27 @@ static unsigned time_keepalive = 1200;
 module_param(time_keepalive, uint, 0);
 static unsigned len_ua = 2;
 module_param(len_ua, uint, 0);
+static unsigned mem_budget = 4096;              // 单位为 KB，为 0 时不限制
+module_param(mem_budget, uint, 0);
+static unsigned time_hold = 200;                // 一个包最多截留多久，单位为毫秒，为 0 时不限制
+module_param(time_hold, uint, 0);
+static bool stateless = false;                  // 无状态优先：完整地落在一个包中的请求不建立流，见 rkpCache.h
+module_param(stateless, bool, 0);
+static unsigned stateless_cache = 4096;         // 无状态优先模式下每个 CPU 的 rkpCache 最多记多少个流
+module_param(stateless_cache, uint, 0);
 static bool verbose = false;
 module_param(verbose, bool, 0);
 static bool debug = false;
 module_param(debug, bool, 0);
+static unsigned record = 64;                    // 飞行记录器每个 CPU 的缓冲区大小，单位为 KB，为 0 时不记录
+module_param(record, uint, 0);
+static bool profile = false;                    // 加载时就打开分阶段计时，之后也可以通过 debugfs 的 xmurp-ua/profile 打开或关闭
+module_param(profile, bool, 0);
+// verbose、debug、profile 和 record 在包的处理路径上都通过 static key 判断，关闭时只是一条空指令
+static DEFINE_STATIC_KEY_FALSE(rkpSetting_verbose);
+static DEFINE_STATIC_KEY_FALSE(rkpSetting_debug);
+static DEFINE_STATIC_KEY_FALSE(rkpSetting_profile);
+static DEFINE_STATIC_KEY_FALSE(rkpSetting_record);
 
 bool rkpSetting_capture(const struct sk_buff*);
 bool rkpSetting_ack(const struct sk_buff*);
@@ -0,0 +1,203 @@
+#pragma once
+#include "common.h"
+
+struct rkpStat
+// 运行时的计数。每个 CPU 各存一份，更新时不加锁，读取时再求和。
+// 每个 rkpManager（即每个网络命名空间）有自己的一份，/proc/net/xmurp-ua 只给出所在命名空间的计数
+{
+    unsigned long packet_seen, packet_captured;
+    unsigned long verdict_accept, verdict_stolen, verdict_drop;
+    unsigned long ua_rewritten, ua_preserved;
+    unsigned long rule_rewritten, rule_preserved;       // str_rule 中的规则修改和保留的头部
+    unsigned long disordered, retransmit;
+    unsigned long lenUa_overflow, malloc_failed;
+    unsigned long budget_bypass, budget_flush;  // 因为内存预算而没有追踪的流、放弃截留的次数
+    unsigned long shrink_evicted, shrink_flushed;       // 内存紧张时被 shrinker 删除的流、放出的包
+    unsigned long hold_expired;                 // 截留超过 time_hold 而原样放出的包
+    unsigned long stateless_handled, stateless_promoted, stateless_demoted, stateless_evicted;
+            // 无状态优先模式下，没有建立流就处理完的包、不得不为之建立流的包、回到请求的边界后删除的流、rkpCache 中被挤掉的条目
+    long flows, packets_held, bytes_held;       // 这几个有增有减，单个 CPU 上的值可能是负的，求和以后才有意义
+};
+static_assert(sizeof(struct rkpStat) % sizeof(unsigned long) == 0, "rkpStat must be an array of longs.");
+
+static DEFINE_PER_CPU(struct rkpStat, rkpStat_percpu);
+        // 不属于任何 rkpManager 的计数（例如 KUnit 测试中），以及已经删除的 rkpManager 留下的计数
+static DEFINE_PER_CPU(struct rkpStat __percpu*, rkpStat_current);
+        // 这个 CPU 上的计数记到哪一份中，为 0 时记到 rkpStat_percpu。
+        // 由 rkpStat_enter 和 rkpStat_leave 成对地设置（持有 rkpManager 的锁时、或者在软中断中），在这期间不能换 CPU
+
+enum
+// 截留一个包的原因
+{
+    rkpStat_hold_scan,                          // ua 跨越了多个包，放在 buff_scan 中
+    rkpStat_hold_disordered,                    // 乱序，放在 buff_disordered 中
+    rkpStat_hold_n
+};
+#define rkpStat_hold_nBucket 40
+struct rkpStat_hold
+// 截留时长的直方图，单位为纳秒，第 i 个桶记录 [2^(i-1), 2^i) 的次数，最后一个桶包括更长的
+{
+    unsigned long bucket[rkpStat_hold_n][rkpStat_hold_nBucket];
+    u_int64_t max[rkpStat_hold_n];
+};
+static DEFINE_PER_CPU(struct rkpStat_hold, rkpStat_hold_percpu);
+
+#define rkpStat_inc(field) this_cpu_inc(__rkpStat_current() -> field)
+#define rkpStat_add(field, n) this_cpu_add(__rkpStat_current() -> field, n)
+#define rkpStat_sub(field, n) this_cpu_sub(__rkpStat_current() -> field, n)
+#define rkpStat_inc_in(stat, field) this_cpu_inc((stat) -> field)      // 记到指定的一份中，不需要 rkpStat_enter
+
+struct rkpStat __percpu* rkpStat_enter(struct rkpStat __percpu*);
+        // 之后这个 CPU 上的计数记到参数指定的一份中，返回原来的，交给 rkpStat_leave 恢复
+void rkpStat_leave(struct rkpStat __percpu*);
+struct rkpStat __percpu* __rkpStat_current(void);
+void rkpStat_sum(struct rkpStat __percpu*, struct rkpStat*);   // 将一份计数在所有 CPU 上的值加起来，第一个参数为 0 时求 rkpStat_percpu
+void rkpStat_fold(struct rkpStat __percpu*);        // 将一份计数加到 rkpStat_percpu 中，在删除 rkpManager 之前调用
+void rkpStat_hold_record(unsigned, u_int64_t);      // 记录一次截留的时长，参数为原因和纳秒数
+void rkpStat_hold_sum(struct rkpStat_hold*);
+
+struct rkpStat __percpu* rkpStat_enter(struct rkpStat __percpu* stat)
+{
+    struct rkpStat __percpu* outer = this_cpu_read(rkpStat_current);
+    this_cpu_write(rkpStat_current, stat);
+    return outer;
+}
+void rkpStat_leave(struct rkpStat __percpu* outer)
+{
+    this_cpu_write(rkpStat_current, outer);
+}
+struct rkpStat __percpu* __rkpStat_current(void)
+{
+    struct rkpStat __percpu* stat = this_cpu_read(rkpStat_current);
+    return stat != 0 ? stat : &rkpStat_percpu;
+}
+void rkpStat_sum(struct rkpStat __percpu* stat, struct rkpStat* rkpst)
+{
+    unsigned cpu, i;
+    memset(rkpst, 0, sizeof(struct rkpStat));
+    if(stat == 0)
+        stat = &rkpStat_percpu;
+    for_each_possible_cpu(cpu)
+    {
+        const unsigned long* p = (const unsigned long*)per_cpu_ptr(stat, cpu);
+        for(i = 0; i < sizeof(struct rkpStat) / sizeof(unsigned long); i++)
+            ((unsigned long*)rkpst)[i] += p[i];
+    }
+}
+void rkpStat_fold(struct rkpStat __percpu* stat)
+{
+    struct rkpStat rkpst;
+    unsigned i;
+    rkpStat_sum(stat, &rkpst);
+    // 加到当前 CPU 上那一份中，和其它计数一样用 this_cpu_add，不需要关中断
+    for(i = 0; i < sizeof(struct rkpStat) / sizeof(unsigned long); i++)
+        this_cpu_add(((unsigned long __percpu*)&rkpStat_percpu)[i], ((const unsigned long*)&rkpst)[i]);
+}
+
+void rkpStat_hold_record(unsigned reason, u_int64_t ns)
+{
+    unsigned i = fls64(ns);
+    if(i >= rkpStat_hold_nBucket)
+        i = rkpStat_hold_nBucket - 1;
+    this_cpu_inc(rkpStat_hold_percpu.bucket[reason][i]);
+    if(ns > this_cpu_read(rkpStat_hold_percpu.max[reason]))
+        this_cpu_write(rkpStat_hold_percpu.max[reason], ns);
+}
+void rkpStat_hold_sum(struct rkpStat_hold* rkpsth)
+{
+    unsigned cpu, i, j;
+    memset(rkpsth, 0, sizeof(struct rkpStat_hold));
+    for_each_possible_cpu(cpu)
+    {
+        const struct rkpStat_hold* p = per_cpu_ptr(&rkpStat_hold_percpu, cpu);
+        for(i = 0; i < rkpStat_hold_n; i++)
+        {
+            for(j = 0; j < rkpStat_hold_nBucket; j++)
+                rkpsth -> bucket[i][j] += p -> bucket[i][j];
+            if(p -> max[i] > rkpsth -> max[i])
+                rkpsth -> max[i] = p -> max[i];
+        }
+    }
+}
+
+enum
+// 处理路径上分别计时的阶段。有嵌套关系：lockHold 包括 lookup、scan、modify 和锁中的 send，modify 包括 csum
+{
+    rkpStat_stage_capture,                      // rkpSetting_capture 判断是否捕获
+    rkpStat_stage_lockWait,                     // 等待 rkpManager 的锁
+    rkpStat_stage_lockHold,                     // 持有 rkpManager 的锁
+    rkpStat_stage_lookup,                       // 在桶中查找流
+    rkpStat_stage_scan,                         // __rkpStream_scan
+    rkpStat_stage_modify,                       // rkpMap_modify
+    rkpStat_stage_csum,                         // rkpPacket_csum
+    rkpStat_stage_send,                         // 将截留的包重新发出（rkpPacket_send）
+    rkpStat_stage_n
+};
+struct rkpStat_stage
+// 每个阶段的累计耗时和次数，只在打开 profile 时记录。耗时的单位是 get_cycles 的周期，平台没有周期计数器时是纳秒
+{
+    u_int64_t cycles[rkpStat_stage_n];
+    unsigned long calls[rkpStat_stage_n];
+};
+static DEFINE_PER_CPU(struct rkpStat_stage, rkpStat_stage_percpu);
+static bool rkpStat_stage_ns;                   // get_cycles 不可用，改用纳秒
+
+// 在一个阶段开始时取得时间，结束时记录。关闭时 begin 返回 0，end 不记录，开关在中途切换也不会记下错误的值
+#define rkpStat_stage_begin() (static_branch_unlikely(&rkpSetting_profile) ? rkpStat_stage_now() : 0)
+#define rkpStat_stage_end(stage, begin) do { if(static_branch_unlikely(&rkpSetting_profile) && (begin) != 0) \
+        rkpStat_stage_record(stage, begin); } while(0)
+
+void rkpStat_stage_init(void);                      // 检查 get_cycles 是否可用
+u_int64_t rkpStat_stage_now(void);
+void rkpStat_stage_record(unsigned, u_int64_t);     // 记录一次，参数为阶段和开始的时间
+void rkpStat_stage_sum(struct rkpStat_stage*);
+void rkpStat_stage_reset(void);                     // 清零。与正在进行的记录之间不加锁，清零的同时记下的个别值可能丢失
+void rkpStat_stage_show(struct seq_file*);          // 每个阶段输出一行：名称、次数、总耗时、平均耗时
+
+void rkpStat_stage_init(void)
+{
+    // 有些平台（例如部分 MIPS）的 get_cycles 总是返回 0
+    rkpStat_stage_ns = get_cycles() == 0 && get_cycles() == 0;
+}
+u_int64_t rkpStat_stage_now(void)
+{
+    return rkpStat_stage_ns ? ktime_get_ns() : (u_int64_t)get_cycles();
+}
+void rkpStat_stage_record(unsigned stage, u_int64_t begin)
+{
+    this_cpu_add(rkpStat_stage_percpu.cycles[stage], rkpStat_stage_now() - begin);
+    this_cpu_inc(rkpStat_stage_percpu.calls[stage]);
+}
+void rkpStat_stage_sum(struct rkpStat_stage* rkpsts)
+{
+    unsigned cpu, i;
+    memset(rkpsts, 0, sizeof(struct rkpStat_stage));
+    for_each_possible_cpu(cpu)
+    {
+        const struct rkpStat_stage* p = per_cpu_ptr(&rkpStat_stage_percpu, cpu);
+        for(i = 0; i < rkpStat_stage_n; i++)
+        {
+            rkpsts -> cycles[i] += p -> cycles[i];
+            rkpsts -> calls[i] += p -> calls[i];
+        }
+    }
+}
+void rkpStat_stage_reset(void)
+{
+    unsigned cpu;
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(&rkpStat_stage_percpu, cpu), 0, sizeof(struct rkpStat_stage));
+}
+void rkpStat_stage_show(struct seq_file* m)
+{
+    const char* name[rkpStat_stage_n] = {"capture", "lock_wait", "lock_hold", "lookup", "scan", "modify", "csum", "send"};
+    struct rkpStat_stage rkpsts;
+    unsigned i;
+    rkpStat_stage_sum(&rkpsts);
+    seq_printf(m, "# profile %s, unit %s\n", static_branch_unlikely(&rkpSetting_profile) ? "on" : "off",
+            rkpStat_stage_ns ? "ns" : "cycles");
+    seq_printf(m, "# stage calls total avg\n");
+    for(i = 0; i < rkpStat_stage_n; i++)
+        seq_printf(m, "%s %lu %llu %llu\n", name[i], rkpsts.calls[i], (unsigned long long)rkpsts.cycles[i],
+                rkpsts.calls[i] ? (unsigned long long)div64_u64(rkpsts.cycles[i], rkpsts.calls[i]) : 0ull);
+}
@@ -1,135 +1,362 @@
 #pragma once
 #include "common.h"
 
+enum
+{
+    __rkpStream_sniffing_uaBegin,               // 正在寻找 http 头的结尾或者 ua 的开始，这时 buff_scan 中不应该有包
+    __rkpStream_sniffing_uaEnd,                 // 已经找到 ua，正在寻找它的结尾，buff_scan 中可能有包
+    __rkpStream_waiting,                        // 不知道下一个请求从哪里开始（例如 body 使用 chunked 编码），直到下一个 psh 都直接放行
+    __rkpStream_sniffing_headEnd,               // ua 已经处理完，正在寻找 http 头的结尾，以便确定下一个请求的开始
+    __rkpStream_body                            // 正在跳过请求的 body，还剩 body_left 个字节，之后是下一个请求
+};
+enum
+{
+    // 这里的 ua 指任意一条改写规则（见 rkpRule.h）的头部的值，第 0 条规则就是 User-Agent
+    __rkpStream_scan_noFound,                   // 还没找到 ua 的开头
+    __rkpStream_scan_uaBegin,                   // 匹配到了 ua 开头，但是 ua 实际的开头在下个数据包
+    __rkpStream_scan_uaRealBegin,               // 匹配到了 ua 开头，ua 实际的开头在这个数据包
+    __rkpStream_scan_uaEnd,                     // 匹配到了 ua 的结尾，并且需要修改 ua
+    __rkpStream_scan_uaGood,                    // 匹配到了 ua 的结尾，但是不需要修改 ua
+    __rkpStream_scan_headEnd,                   // 匹配到了 http 头部的结尾
+    __rkpStream_scan_uaDone                     // 至少一个 ua 已经处理完（修改或保留），正在寻找其它规则的头部或者 http 头部的结尾
+};
+enum
+{
+    __rkpStream_framing_none,                   // 没有 body，头部之后紧接着下一个请求
+    __rkpStream_framing_length,                 // body 的长度由 Content-Length 给出
+    __rkpStream_framing_unknown                 // 无法确定 body 的长度（Transfer-Encoding、Content-Length 重复、溢出或者没有数字）
+};
+
+struct rkpStream_cold
+// 流中只有扫描和截留时才用到的部分。只在扫描到一半或者有截留的包时存在，其它时候（即休眠）释放
+{
+    u_int8_t scan_status;                       // 记录扫描结果，仅由 __rkpStream_scan 和 __rkpStream_reset 设置，由 rkpStream_execute 和 __rkpStream_scan 读取
+    struct rkpPacket *buff_scan, *buff_disordered;      // 分别存储准备扫描的、因乱序而提前收到的数据包，都按照序号排好了
+    uint32_t scan_uaBegin_seq, scan_uaEnd_seq;
+            // 记录 ua 开头和结束的序列号，仅由 __rkpStream_scan、__rkpStream_reset 设置
+    struct rkpStream* stream;                   // 所属的流
+    struct list_head held;                      // 有截留的包时由 rkpManager 挂到它的 held 链表上，cold 释放时取下
+    u_int8_t scan_framing;                      // 当前请求的 body 的长度怎样确定，仅由 __rkpStream_scan_head 和 __rkpStream_reset 设置
+    u_int8_t scan_rule;                         // 正在扫描的 ua 属于哪一条规则
+    u_int8_t scan_contentLength_reading;        // 0 表示没有在读取 Content-Length 的值，1 表示在冒号后面的空白中，2 表示在数字中
+    u_int16_t scan_state;                       // 在 rkpRule 的自动机中的状态（用 rkpRule_offset 表示），仅由 __rkpStream_scan 和 __rkpStream_reset 设置
+    u_int32_t scan_contentLength;               // 已经读到的 Content-Length 的值
+    unsigned scan_uaEnd_matched, scan_uaPreserve_matched[];
+            // 记录现在已经匹配了多少个字节，仅由 __rkpStream_scan 和 __rkpStream_reset 使用。scan_uaPreserve_matched 的长度为 rkpRule_n_preserve
+};
+
 struct rkpStream
-// 接管一个 TCP 流。
+// 接管一个 TCP 流。这里只放每个包都要用到的部分，保证在一个 64 字节的缓存行以内
 {
-    enum
-    {
-        __rkpStream_sniffing_uaBegin,           // 正在寻找 http 头的结尾或者 ua 的开始，这时 buff_scan 中不应该有包
-        __rkpStream_sniffing_uaEnd,             // 已经找到 ua，正在寻找它的结尾，buff_scan 中可能有包
-        __rkpStream_waiting                     // 已经找到 ua 的结尾或者 http 头的结尾并且还没有 psh，接下来的包都直接放行
-    } status;
-    enum
-    {
-        __rkpStream_scan_noFound,               // 还没找到 ua 的开头
-        __rkpStream_scan_uaBegin,               // 匹配到了 ua 开头，但是 ua 实际的开头在下个数据包
-        __rkpStream_scan_uaRealBegin,           // 匹配到了 ua 开头，ua 实际的开头在这个数据包
-        __rkpStream_scan_uaEnd,                 // 匹配到了 ua 的结尾，并且需要修改 ua
-        __rkpStream_scan_uaGood,                // 匹配到了 ua 的结尾，但是不需要修改 ua
-        __rkpStream_scan_headEnd                // 匹配到了 http 头部的结尾，没有发现 ua
-    } scan_status;                              // 记录扫描结果，仅由 __rkpStream_scan 和 __rkpStream_reset 设置，由 rkpStream_execute 和 __rkpStream_scan 读取
     u_int32_t id[3];                            // 按顺序存储客户地址、服务地址、客户端口、服务端口，已经转换字节序
-    struct rkpPacket *buff_scan, *buff_disordered;      // 分别存储准备扫描的、因乱序而提前收到的数据包，都按照序号排好了
     int32_t seq_offset;                         // 序列号的偏移。使得 buff_scan 中第一个字节的编号为零。在 rkpStream 中，序列号使用相对值；但在传给下一层时，使用绝对值
+    u_int8_t status;
     bool active;                                // 是否仍然活动，流每次处理的时候会置为 true，每隔一段时间会删除标志为 false（说明它在这段时间里没有活动）的流，将标志为 true 的流的标志也置为 false。
-    unsigned scan_headEnd_matched, scan_uaBegin_matched, scan_uaEnd_matched, *scan_uaPreserve_matched;
-            // 记录现在已经匹配了多少个字节，仅由 __rkpStream_scan 和 __rkpStream_reset 使用
-    uint32_t scan_uaBegin_seq, scan_uaEnd_seq;
-            // 记录 ua 开头和结束的序列号，仅由 __rkpStream_scan、__rkpStream_reset 设置
+    bool scan_midLine;                          // cold 释放时扫描停在一行的中间，重新分配时从 rkpRule_state_root 而不是一行的开头继续。仅由 __rkpStream_cold_put、__rkpStream_reset 设置
+    u_int32_t last_active;                      // 最后一次活动的时间，为 jiffies 的低 32 位，只用来统计
+    u_int32_t body_left;                        // body 状态下，距离下一个请求的开始还有多少字节
     struct rkpMap* map;                         // 记录 ua 的位置，方便修改重传数据包，仅由 __rkpStream_modify 使用
+    struct rkpStream_cold* cold;                // 没有在扫描、也没有截留包的时候为 0
     struct rkpStream *prev, *next;
 };
+static_assert(sizeof(struct rkpStream) <= 64, "rkpStream does not fit in a cache line.");
+
+struct rkpStream_info
+// 一个流的快照，用来在不持有锁的情况下输出
+{
+    u_int32_t id[3];
+    u_int8_t status, scan_status;
+    int32_t seq_offset;
+    unsigned n_scan, bytes_scan, n_disordered, bytes_disordered, n_map;
+    unsigned mem;                               // 这个流占用的全部内存，包括截留的 skb
+    u_int32_t idle;                             // 多久没有活动了，单位为毫秒
+};
 
 struct rkpStream* rkpStream_new(const struct rkpPacket*);
 void rkpStream_delete(struct rkpStream*);
+void rkpStream_init(struct rkpStream*, const struct rkpPacket*);
+        // 以一个包初始化一个流，不计数。无状态优先模式下，没有对应的流的包先交给栈上用它初始化的临时的流处理
+struct rkpStream* rkpStream_move(struct rkpStream*);
+        // 临时的流处理完一个包后还需要继续追踪时，把它搬到堆上，之后它不再拥有 cold 和映射。分配失败时返回 0
+void rkpStream_release(struct rkpStream*);      // 释放流中的 cold（连同截留的包）和映射，但不释放流本身
+bool rkpStream_boundary(const struct rkpStream*, const struct rkpPacket*);
+        // 刚处理完的这个包是否恰好在一个请求的边界上结束：流中没有截留的包、没有扫描到一半的头部、也不在 body 中，下一个包从新的请求开始
+
+void rkpStream_info(const struct rkpStream*, struct rkpStream_info*);         // 生成快照，调用者需要持有 rkpManager 的锁
+void rkpStream_flush(struct rkpStream*, struct rkpPacket**);
+        // 放弃截留：将 buff_scan 和 buff_disordered 中的包原样移到第二个参数指定的链表的末尾（由调用者发出），
+        // 状态置为 waiting，直到下一个 psh 都不再扫描。seq_offset 移到这些包中最靠后的结尾
+u_int64_t rkpStream_holdSince(const struct rkpStream*);         // 截留的包中最早的一个开始截留的时间（纳秒），没有截留的包时返回 0
 
 bool rkpStream_belongTo(const struct rkpStream*, const struct rkpPacket*);      // 判断一个数据包是否属于一个流
 unsigned rkpStream_execute(struct rkpStream*, struct rkpPacket*);               // 已知一个数据包属于这个流后，处理这个数据包
+unsigned __rkpStream_execute(struct rkpStream*, struct rkpPacket*);             // rkpStream_execute 的实际实现，rkpStream_execute 只是多记录了跟踪点
 
 int32_t __rkpStream_seq_desired(const struct rkpStream*);                 // 返回 buff_scan 中最后一个数据包的后继的第一个字节的相对序列号
 
-void __rkpStream_scan(struct rkpStream*, struct rkpPacket*);    // 对一个最新的包进行扫描
+unsigned __rkpStream_scan(struct rkpStream*, struct rkpPacket*, unsigned);
+        // 从应用层数据的指定偏移处开始扫描一个最新的包，匹配到 ua 的结尾、需要保留的 ua 或者 http 头的结尾时停下，返回停下的偏移（匹配到的最后一个字节之后）
+unsigned __rkpStream_scan_head(struct rkpStream_cold*, unsigned, unsigned char);
+        // 在 ua 之外的头部中，自动机读入一个字节后到达了匹配状态，或者正在读取 Content-Length 的值时调用，参数为到达的状态和这个字节。
+        // 记录 Content-Length 和 Transfer-Encoding；匹配到 headEnd 或者某条规则的名称时返回 rkpRule_match_headEnd 或 rkpRule_match_rule + 规则的编号，否则返回 rkpRule_match_none
 void __rkpStream_reset(struct rkpStream*);                      // 重置扫描进度，包括将 buff_scan 中的包全部发出
 
+bool __rkpStream_cold_get(struct rkpStream*);                   // 确保 cold 存在，需要时分配并重置扫描进度。分配失败时返回 false
+void __rkpStream_cold_put(struct rkpStream*);                   // 如果流已经休眠（没有截留的包，也没有扫描到一半），释放 cold
+void __rkpStream_track(struct rkpStream*);                      // 流开始被 rkpManager 追踪时计数，并记录跟踪点和飞行记录器
+
 struct rkpStream* rkpStream_new(const struct rkpPacket* rkpp)
 {
     struct rkpStream* rkps;
-    if(debug)
-        printk("rkpStream_new\n");
-    rkps = (struct rkpStream*)rkpMalloc(sizeof(struct rkpStream) + sizeof(unsigned) * n_str_preserve);
+    rkps = (struct rkpStream*)rkpMalloc(sizeof(struct rkpStream));
     if(rkps == 0)
         return 0;
-    rkps -> scan_uaPreserve_matched = (unsigned*)((void*)rkps + sizeof(struct rkpStream));
+    rkpStream_init(rkps, rkpp);
+    __rkpStream_track(rkps);
+    return rkps;
+}
+void rkpStream_delete(struct rkpStream* rkps)
+{
+    trace_rkp_stream_delete(rkps -> id);
+    if(static_branch_unlikely(&rkpSetting_record))
+        rkpRecord_stream(rkpRecord_event_delete, rkps -> id, 0);
+    rkpStream_release(rkps);
+    rkpFree(rkps);
+    rkpStat_sub(flows, 1);
+}
+void rkpStream_init(struct rkpStream* rkps, const struct rkpPacket* rkpp)
+{
     rkps -> status = __rkpStream_sniffing_uaBegin;
     memcpy(rkps -> id, rkpp -> lid, 3 * sizeof(u_int32_t));
-    rkps -> buff_scan = rkps -> buff_disordered = 0;
+    rkps -> cold = 0;
     rkps -> seq_offset = rkpPacket_seq(rkpp, 0);
     if(rkpPacket_syn(rkpp))
         rkps -> seq_offset++;
     rkps -> active = true;
+    rkps -> scan_midLine = false;
+    rkps -> last_active = jiffies;
+    rkps -> body_left = 0;
     rkps -> map = 0;
     rkps -> prev = rkps -> next = 0;
-    __rkpStream_reset(rkps);
-    return rkps;
 }
-void rkpStream_delete(struct rkpStream* rkps)
+struct rkpStream* rkpStream_move(struct rkpStream* rkps)
+{
+    struct rkpStream* rkps2 = (struct rkpStream*)rkpMalloc(sizeof(struct rkpStream));
+    if(rkps2 == 0)
+        return 0;
+    memcpy(rkps2, rkps, sizeof(struct rkpStream));
+    // cold 和映射本来就在堆上，只有 cold 中指回流的指针需要改
+    if(rkps2 -> cold != 0)
+        rkps2 -> cold -> stream = rkps2;
+    rkps -> cold = 0;
+    rkps -> map = 0;
+    __rkpStream_track(rkps2);
+    return rkps2;
+}
+void rkpStream_release(struct rkpStream* rkps)
 {
     struct rkpMap* rkpm;
-    if(debug)
-        printk("rkpStream_delete\n");
-    rkpPacket_deletel(&rkps -> buff_scan);
-    rkpPacket_deletel(&rkps -> buff_disordered);
-    for(rkpm = rkps -> map; rkpm != 0; rkpm = rkpm -> next)
+    // 截留的包已经不归内核管了，需要连同 skb 一起释放
+    if(rkps -> cold != 0)
+    {
+        rkpPacket_dropl(&rkps -> cold -> buff_scan);
+        rkpPacket_dropl(&rkps -> cold -> buff_disordered);
+        list_del_init(&rkps -> cold -> held);
+        rkpFree(rkps -> cold);
+        rkps -> cold = 0;
+    }
+    while(rkps -> map != 0)
+    {
+        rkpm = rkps -> map;
+        rkps -> map = rkpm -> next;
         rkpMap_delete(rkpm);
-    rkpFree(rkps);
+    }
+}
+bool rkpStream_boundary(const struct rkpStream* rkps, const struct rkpPacket* rkpp)
+{
+    unsigned len = rkpPacket_appLen(rkpp);
+    if(rkpp -> ack || len == 0 || rkps -> cold != 0 || rkps -> status != __rkpStream_sniffing_uaBegin)
+        return false;
+    // 这个包必须是流中最后处理的包，否则流停在哪里和它无关
+    if(rkpPacket_seq(rkpp, rkps -> seq_offset) + (int32_t)len != 0)
+        return false;
+    // 有 psh 时，不管停在哪里，下一个包都会从头开始扫描（见 __rkpStream_execute）。
+    // 没有 psh 时，sniffing_uaBegin 也可能是扫描到一半时 cold 被释放了，只有包恰好以 http 头的结尾结束时才能确定
+    return rkpPacket_psh(rkpp) || (len >= 4 && memcmp(rkpPacket_appEnd(rkpp) - 4, "\r\n\r\n", 4) == 0);
+}
+
+void rkpStream_info(const struct rkpStream* rkps, struct rkpStream_info* info)
+{
+    const struct rkpPacket* rkpp;
+    const struct rkpMap* rkpm;
+    memcpy(info -> id, rkps -> id, 3 * sizeof(u_int32_t));
+    info -> status = rkps -> status;
+    info -> scan_status = rkps -> cold != 0 ? rkps -> cold -> scan_status : __rkpStream_scan_noFound;
+    info -> seq_offset = rkps -> seq_offset;
+    info -> n_scan = info -> bytes_scan = info -> n_disordered = info -> bytes_disordered = info -> n_map = 0;
+    if(rkps -> cold != 0)
+    {
+        for(rkpp = rkps -> cold -> buff_scan; rkpp != 0; rkpp = rkpp -> next)
+        {
+            info -> n_scan++;
+            info -> bytes_scan += rkpp -> skb -> truesize;
+        }
+        for(rkpp = rkps -> cold -> buff_disordered; rkpp != 0; rkpp = rkpp -> next)
+        {
+            info -> n_disordered++;
+            info -> bytes_disordered += rkpp -> skb -> truesize;
+        }
+    }
+    for(rkpm = rkps -> map; rkpm != 0; rkpm = rkpm -> next)
+        info -> n_map++;
+    info -> mem = sizeof(struct rkpStream) + info -> n_map * sizeof(struct rkpMap)
+            + (info -> n_scan + info -> n_disordered) * sizeof(struct rkpPacket) + info -> bytes_scan + info -> bytes_disordered;
+    if(rkps -> cold != 0)
+        info -> mem += sizeof(struct rkpStream_cold) + sizeof(unsigned) * rkpRule_n_preserve;
+    info -> idle = jiffies_to_msecs((u_int32_t)jiffies - rkps -> last_active);
+}
+
+void rkpStream_flush(struct rkpStream* rkps, struct rkpPacket** rkppl)
+{
+    struct rkpPacket** buff[2];
+    struct rkpPacket *rkpp, *tail;
+    unsigned i;
+    if(rkps -> cold == 0)
+    {
+        rkps -> status = __rkpStream_waiting;
+        return;
+    }
+    buff[0] = &rkps -> cold -> buff_scan;
+    buff[1] = &rkps -> cold -> buff_disordered;
+    if(static_branch_unlikely(&rkpSetting_record))
+        rkpRecord_stream(rkpRecord_event_flush, rkps -> id, min(rkpPacket_num(buff[0]) + rkpPacket_num(buff[1]), 0xFFU));
+    for(tail = *rkppl; tail != 0 && tail -> next != 0; tail = tail -> next);
+    for(i = 0; i < 2; i++)
+    {
+        if(*buff[i] == 0)
+            continue;
+        // 不经过 pop 和 insert，这样截留的计数和时长会一直算到包真正发出的时候
+        for(rkpp = *buff[i]; rkpp != 0; rkpp = rkpp -> next)
+            if(rkpPacket_seq(rkpp, rkps -> seq_offset) + (int32_t)rkpPacket_appLen(rkpp) > 0)
+                rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
+        if(tail == 0)
+            *rkppl = *buff[i];
+        else
+        {
+            tail -> next = *buff[i];
+            (*buff[i]) -> prev = tail;
+        }
+        for(tail = *buff[i]; tail -> next != 0; tail = tail -> next);
+        *buff[i] = 0;
+    }
+    rkps -> status = __rkpStream_waiting;
+    __rkpStream_cold_put(rkps);
+}
+
+u_int64_t rkpStream_holdSince(const struct rkpStream* rkps)
+{
+    const struct rkpPacket* rkpp;
+    u_int64_t rtn = 0;
+    if(rkps -> cold == 0)
+        return 0;
+    for(rkpp = rkps -> cold -> buff_scan; rkpp != 0; rkpp = rkpp -> next)
+        if(rtn == 0 || rkpp -> hold_time < rtn)
+            rtn = rkpp -> hold_time;
+    for(rkpp = rkps -> cold -> buff_disordered; rkpp != 0; rkpp = rkpp -> next)
+        if(rtn == 0 || rkpp -> hold_time < rtn)
+            rtn = rkpp -> hold_time;
+    return rtn;
 }
 
 bool rkpStream_belongTo(const struct rkpStream* rkps, const struct rkpPacket* rkpp)
 {
-    if(debug)
-        printk("rkpStream_belongTo\n");
     return memcmp(rkps -> id, rkpp -> lid, 3 * sizeof(u_int32_t)) == 0;
 }
 unsigned rkpStream_execute(struct rkpStream* rkps, struct rkpPacket* rkpp)
+{
+    // 截留的包可能在返回之前就被处理乱序包时发出并释放了，需要的值都要先取出来
+    int32_t seq = rkpPacket_seq(rkpp, 0);
+    unsigned len = rkpPacket_appLen(rkpp);
+    bool ack = rkpp -> ack;
+    unsigned rtn;
+    struct rkpRecord rkpr, *rkpr_outer = 0;
+    if(static_branch_unlikely(&rkpSetting_record))
+    {
+        memset(&rkpr, 0, sizeof(struct rkpRecord));
+        rkpr.flow = rkpRecord_hash(rkps -> id);
+        rkpr.seq = ack ? rkpPacket_seqAck(rkpp, 0) : seq;
+        rkpr.len = len;
+        rkpr.event = rkpRecord_event_execute;
+        rkpr.flags = (ack ? rkpRecord_flag_ack : 0) | (rkpPacket_psh(rkpp) ? rkpRecord_flag_psh : 0);
+        rkpr.status_before = rkps -> status;
+        rkpr.scan_before = rkps -> cold != 0 ? rkps -> cold -> scan_status : __rkpStream_scan_noFound;
+        rkpr_outer = this_cpu_read(rkpRecord_current);
+        this_cpu_write(rkpRecord_current, &rkpr);
+    }
+    rtn = __rkpStream_execute(rkps, rkpp);
+    trace_rkp_stream_verdict(rkps -> id, seq, len, ack, rkps -> status, rtn);
+    if(static_branch_unlikely(&rkpSetting_record) && this_cpu_read(rkpRecord_current) == &rkpr)
+    {
+        rkpr.status_after = rkps -> status;
+        rkpr.scan_after = rkps -> cold != 0 ? rkps -> cold -> scan_status : __rkpStream_scan_noFound;
+        rkpr.verdict = rtn;
+        rkpRecord_write(&rkpr);
+        this_cpu_write(rkpRecord_current, rkpr_outer);
+    }
+    return rtn;
+}
+unsigned __rkpStream_execute(struct rkpStream* rkps, struct rkpPacket* rkpp)
 // 不要害怕麻烦，咱们把每一种情况都慢慢写一遍。
 {
-    if(debug)
-        printk("rkp-ua: rkpStream_execute start, judging %u ...\n", rkpPacket_seq(rkpp, 0));
-
     // 肯定需要更新活动情况
     rkps -> active = true;
+    rkps -> last_active = jiffies;
     
     // 首先处理如果是 ack 的情况
     if(rkpp -> ack)
     {
-        if(debug)
-            printk("ack packet\n");
         rkpMap_refresh(&rkps -> map, rkpPacket_seqAck(rkpp, 0));
         return NF_ACCEPT;
     }
 
     // 其它情况，首先放掉所有没有应用层数据的包
     if(rkpPacket_appLen(rkpp) == 0)
-    {
-        if(debug)
-            printk("empty packet\n");
         return NF_ACCEPT;
-    }
 
     // 接下来从小到大考虑数据包的序列号的几种情况
     // 已经发出的数据包，使用已有的映射修改
     if(rkpPacket_seq(rkpp, rkps -> seq_offset) < 0)
     {
-        if(debug)
-            printk("\tThe packet is re-transforming or has been modified.\n");
+        rkpStat_inc(retransmit);
         rkpMap_modify(&rkps -> map, &rkpp);
         return NF_ACCEPT;
     }
     // 已经放到 buff_scan 中的数据包，丢弃
     if(rkpPacket_seq(rkpp, rkps -> seq_offset) < __rkpStream_seq_desired(rkps))
     {
-        if(debug)
-            printk("\tThe packet with same seq has been captured, return NF_DROP.\n");
+        rkpStat_inc(retransmit);
         return NF_DROP;
     }
     // 恰好是 buff_scan 的后继数据包，这种情况比较麻烦，写到最后
     // 乱序导致还没接收到前继的数据包，放到 buff_disordered
     if(rkpPacket_seq(rkpp, rkps -> seq_offset) > __rkpStream_seq_desired(rkps))
     {
-        if(debug)
-            printk("\tThe packet is disordered, return NF_STOLEN.\n");
-        rkpPacket_insert_auto(&rkps -> buff_disordered, rkpp, rkps -> seq_offset);
+        rkpStat_inc(disordered);
+        // 超过内存预算时不再等待前面的包，把截留的包和这个包都原样放出去
+        if(rkpMem_over())
+        {
+            struct rkpPacket* rkppl = 0;
+            rkpStat_inc(budget_flush);
+            rkpStream_flush(rkps, &rkppl);
+            rkpPacket_sendl(&rkppl);
+            if(rkpPacket_seq(rkpp, rkps -> seq_offset) + (int32_t)rkpPacket_appLen(rkpp) > 0)
+                rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
+            return NF_ACCEPT;
+        }
+        if(!__rkpStream_cold_get(rkps))
+            return NF_ACCEPT;
+        rkpp -> hold_reason = rkpStat_hold_disordered;
+        rkpPacket_insert_auto(&rkps -> cold -> buff_disordered, rkpp, rkps -> seq_offset);
         return NF_STOLEN;
     }
 
@@ -139,223 +366,153 @@ unsigned rkpStream_execute(struct rkpStream* rkps, struct rkpPacket* rkpp)
     {
         // 因为一会儿可能还需要统一考虑 buff_disordered 中的包，因此不直接 return，将需要的返回值写到这里，最后再 return
         unsigned rtn = NF_ACCEPT;
+        // 一个包中可能有多个请求（pipelining，或者客户端连续发出的请求被合并到了一个包中），因此从头到尾一段一段地处理，pos 为处理到的位置
+        unsigned pos = 0, len = rkpPacket_appLen(rkpp);
+        // 这个包中是否生成了新的映射
+        bool mapped = false;
+        u_int64_t t;
 
-        if(debug)
-            printk("\tThe packet is desired one, further judging.\n");
-
-        // 接下来分析几种情况
-        //      * sniffing_uaBegin 状态下，先扫描这个数据包，再看情况处理。需要考虑 scan_status 和是否有 psh。
-        //          * 没有 psh 的情况：
-        //              * noFound：更新 seq_offset，返回 NF_ACCEPT。
-        //              * uaBegin：状态切换为 sniffing_uaEnd，更新 seq_offset，返回 NF_ACCEPT。
-        //              * uaRealBegin：保留数据包，状态切换为 sniffing_uaEnd，返回 NF_STOLEN。
-        //              * uaEnd：生成映射，修改数据包，重置扫描进度，状态切换为 waiting，更新 seq_offset，返回 NF_ACCEPT。
-        //              * uaGood 或 headEnd：重置扫描进度，状态切换为 waiting，更新 seq_offset，返回 NF_ACCEPT。
-        //          * 有 psh 的情况：
-        //              * noFound、uaBegin、uaRealBegin、uaGood 或 headEnd：重置扫描进度，更新 seq_offset，返回 NF_ACCEPT。
-        //              * uaEnd：生成映射，修改数据包，重置扫描进度，更新 seq_offset，返回 NF_ACCEPT。
-        //      * sniffing_uaEnd 状态下，同样是先扫描数据包，然后再分情况处理。需要考虑 scan_status、是否有 psh 以及是否达到最大长度
-        //          * 没有 psh 的情况：
-        //              * uaBegin 或 uaRealBegin：如果到了最大长度，就发出警告（ua 最大长度可能太小），重置扫描进度，发出数据包，状态切换为 waiting，更新 seq_offset，返回 NF_ACCEPT；
-        //                      否则，保留数据包，返回 NF_STOLEN。
-        //              * uaEnd：生成映射，修改数据包，重置扫描进度，发出数据包，状态切换为 waiting，更新 seq_offset，返回 NF_ACCEPT。
-        //              * uaGood：重置扫描进度，发出数据包，状态切换为 waiting，更新 seq_offset，返回 NF_ACCEPT。
-        //          * 有 psh 的情况：
-        //              * uaBegin、uaRealBegin 或 uaGood：重置扫描进度，发出数据包，状态切换为 sniffing_uaBegin，更新 seq_offset，返回 NF_ACCEPT。
-        //              * uaEnd：生成映射，修改数据包，重置扫描进度，发出数据包，状态切换为 sniffing_uaBegin，更新 seq_offset，返回 NF_ACCEPT。
-        //      * waiting 状态下，如果有 psh，则将状态切换为 sniffing_uaBegin，否则不切换；然后更新 seq_offset，返回 NF_ACCEPT 即可。
-
-        if(rkps -> status == __rkpStream_sniffing_uaBegin)
+        // 先处理这个包中的每一段，按状态分情况：
+        //      * body：跳过 body_left 个字节，跳过完毕后状态切换为 sniffing_uaBegin。
+        //      * waiting：不再处理这个包剩下的部分。
+        //      * sniffing_uaBegin、sniffing_uaEnd 或 sniffing_headEnd：从 pos 开始扫描，按扫描停下时的 scan_status 处理：
+        //          * noFound：到了包的末尾，还没有找到 ua。
+        //          * uaBegin 或 uaRealBegin：到了包的末尾，ua 还没有结束，状态切换为 sniffing_uaEnd。
+        //          * uaEnd：生成映射，scan_status 切换为 uaDone，状态切换为 sniffing_headEnd，继续扫描其它规则的头部和 http 头的结尾。
+        //          * uaGood：scan_status 切换为 uaDone，状态切换为 sniffing_headEnd，继续扫描。
+        //          * uaDone：到了包的末尾，还没有找到 http 头的结尾，状态切换为 sniffing_headEnd。
+        //          * headEnd：一个请求的头部结束了，重置扫描进度，按 body 的长度决定下一个请求从哪里开始：
+        //              没有 body 时状态切换为 sniffing_uaBegin，有 Content-Length 时切换为 body，无法确定时切换为 waiting。
+        // 然后处理这个包本身。如果生成了新的映射，修改 buff_scan 中的包和这个包，再分情况：
+        //      * sniffing_uaEnd 状态且没有 psh：
+        //          * ua 的开头在这个包之后，并且 buff_scan 为空：更新 seq_offset，返回 NF_ACCEPT。
+        //          * 到了最大长度或者超过了内存预算：发出警告（ua 最大长度可能太小）或者记录，重置扫描进度，发出 buff_scan 中的包，状态切换为 waiting，更新 seq_offset，返回 NF_ACCEPT。
+        //          * 否则，保留数据包，返回 NF_STOLEN。
+        //      * 其它情况：发出 buff_scan 中的包，更新 seq_offset，返回 NF_ACCEPT。有 psh 时，如果不是 body 状态，重置扫描进度，状态切换为 sniffing_uaBegin。
+        while(pos < len && rkps -> status != __rkpStream_waiting)
         {
-            if(debug)
-                printk("\t\tsniffing_uaBegin\n");
-            __rkpStream_scan(rkps, rkpp);
-            if(debug)
+            if(rkps -> status == __rkpStream_body)
             {
-                if(rkps -> scan_status == __rkpStream_scan_noFound)
-                    printk("\t\tnoFound\n");
-                else if(rkps -> scan_status == __rkpStream_scan_uaBegin)
-                    printk("\t\tuaBegin\n");
-                else if(rkps -> scan_status == __rkpStream_scan_uaRealBegin)
-                    printk("\t\tuaRealBegin\n");
-                else if(rkps -> scan_status == __rkpStream_scan_uaEnd)
-                    printk("\t\tuaEnd\n");
-                else if(rkps -> scan_status == __rkpStream_scan_uaGood)
-                    printk("\t\tuaGood\n");
-                else if(rkps -> scan_status == __rkpStream_scan_headEnd)
-                    printk("\t\theadEnd\n");
-                if(rkpPacket_psh(rkpp))
-                    printk("\t\tpsh\n");
+                unsigned n = rkps -> body_left < len - pos ? rkps -> body_left : len - pos;
+                pos += n;
+                rkps -> body_left -= n;
+                if(rkps -> body_left == 0)
+                    rkps -> status = __rkpStream_sniffing_uaBegin;
+                continue;
             }
-            if(!rkpPacket_psh(rkpp))
-                switch (rkps -> scan_status)
-                {
-                case __rkpStream_scan_noFound:
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                    break;
-                case __rkpStream_scan_uaBegin:
-                    rkps -> status = __rkpStream_sniffing_uaEnd;
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                    break;
-                case __rkpStream_scan_uaRealBegin:
-                    rkpPacket_insert_end(&rkps -> buff_scan, rkpp);
-                    rkps -> status = __rkpStream_sniffing_uaEnd;
-                    rtn = NF_STOLEN;
-                    break;
-                case __rkpStream_scan_uaEnd:
-                    rkpMap_insert_end(&rkps -> map, rkpMap_new(rkps -> scan_uaBegin_seq, rkps -> scan_uaEnd_seq));
-                    rkpMap_modify(&rkps -> map, &rkpp);
-                    __rkpStream_reset(rkps);
-                    rkps -> status = __rkpStream_waiting;
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                    break;
-                case __rkpStream_scan_uaGood:
-                case __rkpStream_scan_headEnd:
-                    __rkpStream_reset(rkps);
-                    rkps -> status = __rkpStream_waiting;
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                }
-            else
-                switch (rkps -> scan_status)
+
+            // 需要扫描时才分配 cold，分配失败就放过这个请求
+            if(!__rkpStream_cold_get(rkps))
+            {
+                rkps -> status = __rkpStream_waiting;
+                break;
+            }
+            t = rkpStat_stage_begin();
+            pos = __rkpStream_scan(rkps, rkpp, pos);
+            rkpStat_stage_end(rkpStat_stage_scan, t);
+            trace_rkp_stream_scan(rkps -> id, rkpPacket_seq(rkpp, 0), rkps -> status, rkps -> cold -> scan_status,
+                    rkps -> cold -> scan_uaBegin_seq, rkps -> cold -> scan_uaEnd_seq, rkpPacket_psh(rkpp));
+            switch (rkps -> cold -> scan_status)
+            {
+            case __rkpStream_scan_noFound:
+                break;
+            case __rkpStream_scan_uaBegin:
+            case __rkpStream_scan_uaRealBegin:
+                rkps -> status = __rkpStream_sniffing_uaEnd;
+                break;
+            case __rkpStream_scan_uaEnd:
+                rkpMap_insert_end(&rkps -> map, rkpMap_new(rkps -> cold -> scan_uaBegin_seq, rkps -> cold -> scan_uaEnd_seq,
+                        rkps -> cold -> scan_rule));
+                if(rkps -> cold -> scan_rule == 0)
+                    rkpStat_inc(ua_rewritten);
+                else
+                    rkpStat_inc(rule_rewritten);
+                if(static_branch_unlikely(&rkpSetting_record))
+                    rkpRecord_map(rkps -> cold -> scan_uaBegin_seq, rkps -> cold -> scan_uaEnd_seq - rkps -> cold -> scan_uaBegin_seq);
+                mapped = true;
+                rkps -> cold -> scan_status = __rkpStream_scan_uaDone;
+                rkps -> status = __rkpStream_sniffing_headEnd;
+                break;
+            case __rkpStream_scan_uaGood:
+                rkps -> cold -> scan_status = __rkpStream_scan_uaDone;
+                rkps -> status = __rkpStream_sniffing_headEnd;
+                break;
+            case __rkpStream_scan_uaDone:
+                rkps -> status = __rkpStream_sniffing_headEnd;
+                break;
+            case __rkpStream_scan_headEnd:
+                if(rkps -> cold -> scan_framing == __rkpStream_framing_none)
+                    rkps -> status = __rkpStream_sniffing_uaBegin;
+                else if(rkps -> cold -> scan_framing == __rkpStream_framing_length && rkps -> cold -> scan_contentLength != 0)
                 {
-                case __rkpStream_scan_noFound:
-                case __rkpStream_scan_uaBegin:
-                case __rkpStream_scan_uaRealBegin:
-                case __rkpStream_scan_uaGood:
-                case __rkpStream_scan_headEnd:
-                    __rkpStream_reset(rkps);
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                    break;
-                case __rkpStream_scan_uaEnd:
-                    rkpMap_insert_end(&rkps -> map, rkpMap_new(rkps -> scan_uaBegin_seq, rkps -> scan_uaEnd_seq));
-                    rkpMap_modify(&rkps -> map, &rkpp);
-                    __rkpStream_reset(rkps);
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
+                    rkps -> status = __rkpStream_body;
+                    rkps -> body_left = rkps -> cold -> scan_contentLength;
                 }
+                else if(rkps -> cold -> scan_framing == __rkpStream_framing_length)
+                    rkps -> status = __rkpStream_sniffing_uaBegin;
+                else
+                    rkps -> status = __rkpStream_waiting;
+                __rkpStream_reset(rkps);
+                break;
+            }
         }
-        else if(rkps -> status == __rkpStream_sniffing_uaEnd)
+
+        if(mapped)
+        {
+            rkpMap_modify(&rkps -> map, &rkps -> cold -> buff_scan);
+            rkpMap_modify(&rkps -> map, &rkpp);
+        }
+        if(rkps -> status == __rkpStream_sniffing_uaEnd && !rkpPacket_psh(rkpp))
         {
-            if(debug)
-                printk("\t\tsniffing_uaEnd\n");
-            __rkpStream_scan(rkps, rkpp);
-            if(debug)
+            if(rkps -> cold -> buff_scan == 0
+                    && (int32_t)(rkps -> cold -> scan_uaBegin_seq - (rkpPacket_seq(rkpp, 0) + len)) >= 0)
             {
-                if(rkps -> scan_status == __rkpStream_scan_noFound)
-                    printk("\t\tnoFound\n");
-                else if(rkps -> scan_status == __rkpStream_scan_uaBegin)
-                    printk("\t\tuaBegin\n");
-                else if(rkps -> scan_status == __rkpStream_scan_uaRealBegin)
-                    printk("\t\tuaRealBegin\n");
-                else if(rkps -> scan_status == __rkpStream_scan_uaEnd)
-                    printk("\t\tuaEnd\n");
-                else if(rkps -> scan_status == __rkpStream_scan_uaGood)
-                    printk("\t\tuaGood\n");
-                else if(rkps -> scan_status == __rkpStream_scan_headEnd)
-                    printk("\t\theadEnd\n");
-                if(rkpPacket_psh(rkpp))
-                    printk("\t\tpsh\n");
+                rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
+                rtn = NF_ACCEPT;
             }
-            if(!rkpPacket_psh(rkpp))
-                switch (rkps -> scan_status)
+            else if(rkpPacket_num(&rkps -> cold -> buff_scan) + 1 >= len_ua || rkpMem_over())
+            {
+                if(rkpMem_over())
+                    rkpStat_inc(budget_flush);
+                else
                 {
-                case __rkpStream_scan_uaBegin:
-                case __rkpStream_scan_uaRealBegin:
-                    if(rkpPacket_num(&rkps -> buff_scan) + 1 == len_ua)
-                    {
-                        printk("warning: len_ua may be too short.\n");
-                        __rkpStream_reset(rkps);
-                        rkpPacket_sendl(&rkps -> buff_scan);
-                        rkps -> status = __rkpStream_waiting;
-                        rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                        rtn = NF_ACCEPT;
-                    }
-                    else
-                    {
-                        rkpPacket_insert_end(&rkps -> buff_scan, rkpp);
-                        rtn = NF_STOLEN;
-                    }
-                    break;
-                case __rkpStream_scan_uaEnd:
-                    rkpMap_insert_end(&rkps -> map, rkpMap_new(rkps -> scan_uaBegin_seq, rkps -> scan_uaEnd_seq));
-                    rkpMap_modify(&rkps -> map, &rkps -> buff_scan);
-                    rkpMap_modify(&rkps -> map, &rkpp);
-                    __rkpStream_reset(rkps);
-                    rkpPacket_sendl(&rkps -> buff_scan);
-                    rkps -> status = __rkpStream_waiting;
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                    break;
-                case __rkpStream_scan_uaGood:
-                    __rkpStream_reset(rkps);
-                    rkpPacket_sendl(&rkps -> buff_scan);
-                    rkps -> status = __rkpStream_waiting;
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                    break;
-                case __rkpStream_scan_noFound:
-                case __rkpStream_scan_headEnd:
-                    break;
+                    if(static_branch_unlikely(&rkpSetting_verbose))
+                        printk("rkp-ua: warning: len_ua may be too short.\n");
+                    rkpStat_inc(lenUa_overflow);
                 }
+                __rkpStream_reset(rkps);
+                rkpPacket_sendl(&rkps -> cold -> buff_scan);
+                rkps -> status = __rkpStream_waiting;
+                rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
+                rtn = NF_ACCEPT;
+            }
             else
-                switch (rkps -> scan_status)
-                {
-                case __rkpStream_scan_uaBegin:
-                case __rkpStream_scan_uaRealBegin:
-                case __rkpStream_scan_uaGood:
-                    __rkpStream_reset(rkps);
-                    rkpPacket_sendl(&rkps -> buff_scan);
-                    rkps -> status = __rkpStream_sniffing_uaBegin;
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                    break;
-                case __rkpStream_scan_uaEnd:
-                    rkpMap_insert_end(&rkps -> map, rkpMap_new(rkps -> scan_uaBegin_seq, rkps -> scan_uaEnd_seq));
-                    rkpMap_modify(&rkps -> map, &rkps -> buff_scan);
-                    rkpMap_modify(&rkps -> map, &rkpp);
-                    __rkpStream_reset(rkps);
-                    rkpPacket_sendl(&rkps -> buff_scan);
-                    rkps -> status = __rkpStream_sniffing_uaBegin;
-                    rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
-                    rtn = NF_ACCEPT;
-                    break;
-                case __rkpStream_scan_noFound:
-                case __rkpStream_scan_headEnd:
-                    break;
-                }
+            {
+                rkpPacket_insert_end(&rkps -> cold -> buff_scan, rkpp);
+                rtn = NF_STOLEN;
+            }
         }
-        // else if(rkps -> status == __rkpStream_waiting)
         else
         {
-            if(debug)
+            if(rkps -> cold != 0)
+                rkpPacket_sendl(&rkps -> cold -> buff_scan);
+            if(rkpPacket_psh(rkpp) && rkps -> status != __rkpStream_body)
             {
-                printk("\t\tsniffing_uaBegin\n");
-                if(rkpPacket_psh(rkpp))
-                    printk("\t\tpsh.\n");
-            }
-            if(rkpPacket_psh(rkpp))
+                __rkpStream_reset(rkps);
                 rkps -> status = __rkpStream_sniffing_uaBegin;
+            }
             rkpPacket_makeOffset(rkpp, &rkps -> seq_offset);
             rtn = NF_ACCEPT;
         }
 
-        // 接下来考虑乱序的包
-        while(rkps -> buff_disordered != 0)
+        // 接下来考虑乱序的包。递归调用 rkpStream_execute 时 cold 可能会被释放，所以每次都要重新检查
+        while(rkps -> cold != 0 && rkps -> cold -> buff_disordered != 0)
         {
             // 序列号是已经发出去的，丢弃
-            if(rkpPacket_seq(rkps -> buff_disordered, rkps -> seq_offset) < __rkpStream_seq_desired(rkps))
-            {
-                if(debug)
-                    printk("\tdrop an disordered packet.\n");
-                rkpPacket_drop(rkpPacket_pop_begin(&rkps -> buff_disordered));
-            }
+            if(rkpPacket_seq(rkps -> cold -> buff_disordered, rkps -> seq_offset) < __rkpStream_seq_desired(rkps))
+                rkpPacket_drop(rkpPacket_pop_begin(&rkps -> cold -> buff_disordered));
             // 如果序列号过大，结束循环
-            else if(rkpPacket_seq(rkps -> buff_disordered, rkps -> seq_offset) > __rkpStream_seq_desired(rkps))
+            else if(rkpPacket_seq(rkps -> cold -> buff_disordered, rkps -> seq_offset) > __rkpStream_seq_desired(rkps))
                 break;
             // 如果序列号恰好，把它从链表中取出，然后像刚刚抓到的包那样去执行
             else
@@ -363,19 +520,8 @@ unsigned rkpStream_execute(struct rkpStream* rkps, struct rkpPacket* rkpp)
                 // 将包从链表中取出
                 struct rkpPacket* rkpp2;
                 unsigned rtn;
-                if(debug)
-                    printk("\texecute a disordered packet.\n");
-                rkpp2 = rkpPacket_pop_begin(&rkps -> buff_disordered);
+                rkpp2 = rkpPacket_pop_begin(&rkps -> cold -> buff_disordered);
                 rtn = rkpStream_execute(rkps, rkpp2);
-                if(debug)
-                {
-                    if(rtn == NF_ACCEPT)
-                        printk("\t\treturn NF_ACCEPT.\n");
-                    else if(rtn == NF_DROP)
-                        printk("\t\treturn NF_DROP.\n");
-                    else if(rtn == NF_STOLEN)
-                        printk("\t\treturn NF_STOLEN.\n");
-                }
                 if(rtn == NF_ACCEPT)
                     rkpPacket_send(rkpp2);
                 else if(rtn == NF_DROP)
@@ -383,25 +529,15 @@ unsigned rkpStream_execute(struct rkpStream* rkps, struct rkpPacket* rkpp)
                 else if(rtn == NF_STOLEN);
             }
         }
-        
-        if(debug)
-        {
-            if(rtn == NF_ACCEPT)
-                printk("\treturn NF_ACCEPT.\n");
-            else if(rtn == NF_DROP)
-                printk("\treturn NF_DROP.\n");
-            else if(rtn == NF_STOLEN)
-                printk("\treturn NF_STOLEN.\n");
-        }
+
+        __rkpStream_cold_put(rkps);
         return rtn;
     }
 }
 
 int32_t __rkpStream_seq_desired(const struct rkpStream* rkps)
 {
-    struct rkpPacket* rkpp = rkps -> buff_scan;
-    if(debug)
-        printk("rkpStream_seq_desired\n");
+    struct rkpPacket* rkpp = rkps -> cold != 0 ? rkps -> cold -> buff_scan : 0;
     if(rkpp == 0)
         return 0;
     else
@@ -411,94 +547,214 @@ int32_t __rkpStream_seq_desired(const struct rkpStream* rkps)
     }
 }
 
-void __rkpStream_scan(struct rkpStream* rkps, struct rkpPacket* rkpp)
+unsigned __rkpStream_scan(struct rkpStream* rkps, struct rkpPacket* rkpp, unsigned pos)
 {
-    unsigned char* p = rkpPacket_appBegin(rkpp);
-    if(debug)
-        printk("rkpStream_scan\n");
-
-    // 需要匹配的字符串包括：headEnd、uaBegin、uaEnd、uaPreserve
-    // 开始这个函数时，scan_status 只可能是 noFound、uaBegin 或 uaRealBegin（这两个可以无差别对待）
-    //      * noFound：扫描 uaBegin、headEnd，当匹配到其中一个时停下来开始决策
-    //          * uaBegin：如果已经到数据包末尾，则将状态设置为 uaBegin，写入 scan_uaBegin_seq，返回；否则，将状态设置为 uaRealBegin，写入 scan_uaBegin_seq，继续下个阶段的扫描
+    unsigned char* p = rkpPacket_appBegin(rkpp) + pos;
+
+    // 需要匹配的包括：自动机中的 headEnd 和各条规则的名称（以及用来确定 body 长度的 Content-Length、Transfer-Encoding），ua 的结尾 uaEnd，这条规则的保留列表 uaPreserve
+    // 开始这个函数时，scan_status 只可能是 noFound、uaDone、uaBegin 或 uaRealBegin（这两个可以无差别对待）
+    //      * noFound 或 uaDone：用自动机扫描头部，匹配到某条规则的名称或者 headEnd 时停下来开始决策
+    //          * 规则的名称：记下是哪条规则。如果已经到数据包末尾，则将状态设置为 uaBegin，写入 scan_uaBegin_seq，返回；否则，将状态设置为 uaRealBegin，写入 scan_uaBegin_seq，继续下个阶段的扫描
     //          * headEnd：将状态设置为 headEnd，返回
-    //      * uaBegin 或 uaRealBegin：扫描 uaEnd、uaPreserve，匹配到其中一个时停下来开始决策
-    //          * uaEnd：将状态设置为 uaEnd，设置 scan_uaEnd_seq，返回
-    //          * uaPreserve：将状态设置为 uaGood，返回
+    //      * uaBegin 或 uaRealBegin：扫描 uaEnd、uaPreserve，匹配到其中一个时停下来开始决策。ua 开头的空白不属于 ua，跳过时 scan_uaBegin_seq 随之后移
+    //          * uaEnd：将状态设置为 uaEnd（ua 为空时设置为 uaGood），设置 scan_uaEnd_seq，自动机回到一行的开头，返回
+    //          * uaPreserve：将状态设置为 uaGood，返回。ua 剩下的部分和结尾的 \r\n 之后由自动机扫描
+    // 都没有匹配到时，扫描到包的末尾后返回
 
-    if(rkps -> scan_status == __rkpStream_scan_noFound)
+    if(rkps -> cold -> scan_status == __rkpStream_scan_noFound || rkps -> cold -> scan_status == __rkpStream_scan_uaDone)
+    {
+        // 自动机的状态在循环中放在局部变量里，停下来以后再写回
+        const u_int16_t* next = rkpRule_next;
+        unsigned state = rkps -> cold -> scan_state, state_match = rkpRule_offset(rkpRule_state_match), match = rkpRule_match_none;
         for(; p != rkpPacket_appEnd(rkpp); p++)
         {
-            if(*p == str_uaBegin[rkps -> scan_uaBegin_matched])
-            {
-                rkps -> scan_uaBegin_matched++;
-                if(rkps -> scan_uaBegin_matched == strlen(str_uaBegin))
-                {
-                    if(p + 1 == rkpPacket_appEnd(rkpp))
-                        rkps -> scan_status = __rkpStream_scan_uaBegin;
-                    else
-                        rkps -> scan_status = __rkpStream_scan_uaRealBegin;
-                    rkps -> scan_uaBegin_seq = rkpPacket_seq(rkpp, 0) + ((p + 1) - rkpPacket_appBegin(rkpp));
-                    if(debug)
-                        printk("uaBegin_seq %u\n", rkps -> scan_uaBegin_seq);
-                    p++;
-                    break;
-                }
-            }
-            else
-                rkps -> scan_uaBegin_matched = 0;
-            if(*p == str_headEnd[rkps -> scan_headEnd_matched])
-            {
-                rkps -> scan_headEnd_matched++;
-                if(rkps -> scan_headEnd_matched == strlen(str_headEnd))
-                {
-                    rkps -> scan_status = __rkpStream_scan_headEnd;
-                    return;
-                }
-            }
+            state = next[state + rkpRule_class[*p]];
+            // 绝大多数字节到这里就处理完了
+            if(state < state_match && rkps -> cold -> scan_contentLength_reading == 0)
+                continue;
+            match = __rkpStream_scan_head(rkps -> cold, state, *p);
+            if(match != rkpRule_match_none)
+                break;
+        }
+        rkps -> cold -> scan_state = state;
+        if(match == rkpRule_match_headEnd)
+        {
+            rkps -> cold -> scan_status = __rkpStream_scan_headEnd;
+            return p + 1 - rkpPacket_appBegin(rkpp);
+        }
+        else if(match != rkpRule_match_none)
+        {
+            rkps -> cold -> scan_rule = match - rkpRule_match_rule;
+            if(p + 1 == rkpPacket_appEnd(rkpp))
+                rkps -> cold -> scan_status = __rkpStream_scan_uaBegin;
             else
-                rkps -> scan_headEnd_matched = 0;
+                rkps -> cold -> scan_status = __rkpStream_scan_uaRealBegin;
+            rkps -> cold -> scan_uaBegin_seq = rkpPacket_seq(rkpp, 0) + ((p + 1) - rkpPacket_appBegin(rkpp));
+            rkps -> cold -> scan_uaEnd_matched = 0;
+            memset(rkps -> cold -> scan_uaPreserve_matched, 0, sizeof(unsigned) * rkpRule_rules[rkps -> cold -> scan_rule].n_preserve);
+            p++;
         }
+    }
 
-    if(rkps -> scan_status == __rkpStream_scan_uaBegin || rkps -> scan_status == __rkpStream_scan_uaRealBegin)
+    if(rkps -> cold -> scan_status == __rkpStream_scan_uaBegin || rkps -> cold -> scan_status == __rkpStream_scan_uaRealBegin)
+    {
+        const struct rkpRule* rule = &rkpRule_rules[rkps -> cold -> scan_rule];
         for(; p != rkpPacket_appEnd(rkpp); p++)
         {
             unsigned i;
-            if(*p == str_uaEnd[rkps -> scan_uaEnd_matched])
+            if((*p == ' ' || *p == '\t')
+                    && rkps -> cold -> scan_uaBegin_seq == (u_int32_t)(rkpPacket_seq(rkpp, 0) + (p - rkpPacket_appBegin(rkpp))))
+            {
+                rkps -> cold -> scan_uaBegin_seq++;
+                continue;
+            }
+            if(*p == str_uaEnd[rkps -> cold -> scan_uaEnd_matched])
             {
-                rkps -> scan_uaEnd_matched++;
-                if(rkps -> scan_uaEnd_matched == strlen(str_uaEnd))
+                rkps -> cold -> scan_uaEnd_matched++;
+                if(rkps -> cold -> scan_uaEnd_matched == strlen(str_uaEnd))
                 {
-                    rkps -> scan_status = __rkpStream_scan_uaEnd;
-                    rkps -> scan_uaEnd_seq = rkpPacket_seq(rkpp, 0) + ((p + 1) - rkpPacket_appBegin(rkpp)) - strlen(str_uaEnd);
-                    if(debug)
-                        printk("uaEnd_seq %u\n", rkps -> scan_uaEnd_seq);
-                    return;
+                    rkps -> cold -> scan_uaEnd_seq = rkpPacket_seq(rkpp, 0) + ((p + 1) - rkpPacket_appBegin(rkpp)) - strlen(str_uaEnd);
+                    if(rkps -> cold -> scan_uaEnd_seq == rkps -> cold -> scan_uaBegin_seq)
+                        rkps -> cold -> scan_status = __rkpStream_scan_uaGood;
+                    else
+                        rkps -> cold -> scan_status = __rkpStream_scan_uaEnd;
+                    rkps -> cold -> scan_state = rkpRule_offset(rkpRule_state_lineBegin);
+                    return p + 1 - rkpPacket_appBegin(rkpp);
                 }
             }
             else
-                rkps -> scan_uaEnd_matched = 0;
-            for(i = 0; i < n_str_preserve; i++)
+                rkps -> cold -> scan_uaEnd_matched = 0;
+            for(i = 0; i < rule -> n_preserve; i++)
             {
-                if(*p == str_preserve[i][rkps -> scan_uaPreserve_matched[i]])
+                if(*p == rule -> preserve[i][rkps -> cold -> scan_uaPreserve_matched[i]])
                 {
-                    rkps -> scan_uaPreserve_matched[i]++;
-                    if(rkps -> scan_uaPreserve_matched[i] == strlen(str_preserve[i]))
+                    rkps -> cold -> scan_uaPreserve_matched[i]++;
+                    if(rkps -> cold -> scan_uaPreserve_matched[i] == strlen(rule -> preserve[i]))
                     {
-                        rkps -> scan_status = __rkpStream_scan_uaGood;
-                        return;
+                        rkps -> cold -> scan_status = __rkpStream_scan_uaGood;
+                        rkps -> cold -> scan_state = rkpRule_offset(rkpRule_state_root);
+                        if(rkps -> cold -> scan_rule == 0)
+                            rkpStat_inc(ua_preserved);
+                        else
+                            rkpStat_inc(rule_preserved);
+                        return p + 1 - rkpPacket_appBegin(rkpp);
                     }
                 }
                 else
-                    rkps -> scan_uaPreserve_matched[i] = 0;
+                    rkps -> cold -> scan_uaPreserve_matched[i] = 0;
             }
         }
+    }
+
+    return p - rkpPacket_appBegin(rkpp);
+}
+unsigned __rkpStream_scan_head(struct rkpStream_cold* cold, unsigned state, unsigned char c)
+{
+    // 正在读取 Content-Length 的值：冒号后面可以有空白，然后是数字，遇到其它字节时结束。读到第一个数字时才确定 body 的长度由它给出，
+    // 一个数字都没有就结束的（值为空或者不是数字），当作无法确定
+    if(cold -> scan_contentLength_reading != 0)
+    {
+        if(c >= '0' && c <= '9')
+        {
+            // 太大的话就当作无法确定，避免溢出
+            if(cold -> scan_contentLength > (0xFFFFFFFFU - 9) / 10)
+            {
+                cold -> scan_framing = __rkpStream_framing_unknown;
+                cold -> scan_contentLength_reading = 0;
+            }
+            else
+            {
+                cold -> scan_framing = __rkpStream_framing_length;
+                cold -> scan_contentLength = cold -> scan_contentLength * 10 + (c - '0');
+                cold -> scan_contentLength_reading = 2;
+            }
+        }
+        else if(cold -> scan_contentLength_reading == 2)
+            cold -> scan_contentLength_reading = 0;
+        else if(c != ' ' && c != '\t')
+        {
+            cold -> scan_framing = __rkpStream_framing_unknown;
+            cold -> scan_contentLength_reading = 0;
+        }
+    }
+
+    if(state < rkpRule_offset(rkpRule_state_match))
+        return rkpRule_match_none;
+    state = state / rkpRule_n_class - rkpRule_state_match + 1;
+    if(state == rkpRule_match_contentLength)
+    {
+        // 出现多个 Content-Length 时，不知道服务端会采用哪一个。scan_framing 在读到数字时才设置
+        if(cold -> scan_framing == __rkpStream_framing_none)
+            cold -> scan_contentLength_reading = 1;
+        else
+            cold -> scan_framing = __rkpStream_framing_unknown;
+        cold -> scan_contentLength = 0;
+        return rkpRule_match_none;
+    }
+    if(state == rkpRule_match_transferEncoding)
+    {
+        cold -> scan_framing = __rkpStream_framing_unknown;
+        return rkpRule_match_none;
+    }
+    return state;
 }
 void __rkpStream_reset(struct rkpStream* rkps)
 {
-    if(debug)
-        printk("rkpStream_reset\n");
-    rkps -> scan_status = __rkpStream_scan_noFound;
-    rkps -> scan_headEnd_matched = rkps -> scan_uaBegin_matched = rkps -> scan_uaEnd_matched = 0;
-    memset(rkps -> scan_uaPreserve_matched, 0, sizeof(unsigned) * n_str_preserve);
+    rkps -> scan_midLine = false;
+    if(rkps -> cold == 0)
+        return;
+    rkps -> cold -> scan_status = __rkpStream_scan_noFound;
+    // 不知道是不是在一行的开头（例如流中第一个收到的包），都当作在开头，这样包的开头的名称也能匹配到
+    rkps -> cold -> scan_state = rkpRule_offset(rkpRule_state_lineBegin);
+    rkps -> cold -> scan_rule = 0;
+    rkps -> cold -> scan_uaEnd_matched = 0;
+    memset(rkps -> cold -> scan_uaPreserve_matched, 0, sizeof(unsigned) * rkpRule_n_preserve);
+    rkps -> cold -> scan_framing = __rkpStream_framing_none;
+    rkps -> cold -> scan_contentLength = 0;
+    rkps -> cold -> scan_contentLength_reading = 0;
 }
+
+
+bool __rkpStream_cold_get(struct rkpStream* rkps)
+{
+    bool midLine = rkps -> scan_midLine;
+    if(rkps -> cold != 0)
+        return true;
+    rkps -> cold = rkpMalloc(sizeof(struct rkpStream_cold) + sizeof(unsigned) * rkpRule_n_preserve);
+    if(rkps -> cold == 0)
+        return false;
+    rkps -> cold -> buff_scan = rkps -> cold -> buff_disordered = 0;
+    rkps -> cold -> scan_uaBegin_seq = rkps -> cold -> scan_uaEnd_seq = 0;
+    rkps -> cold -> stream = rkps;
+    INIT_LIST_HEAD(&rkps -> cold -> held);
+    __rkpStream_reset(rkps);
+    // 上次释放时停在一行的中间的话，接下来的内容不能当作一行的开头，否则值中的 "User-Agent:" 之类也会被当作名称
+    if(midLine)
+        rkps -> cold -> scan_state = rkpRule_offset(rkpRule_state_root);
+    return true;
+}
+void __rkpStream_cold_put(struct rkpStream* rkps)
+{
+    if(rkps -> cold == 0 || rkps -> cold -> buff_scan != 0 || rkps -> cold -> buff_disordered != 0)
+        return;
+    // 扫描进度刚好被重置过，或者只是停在一行的开头或中间（用 scan_midLine 记下是哪一种），释放掉以后能够恢复，也可以释放
+    if(rkps -> status != __rkpStream_waiting && rkps -> status != __rkpStream_body
+            && (rkps -> cold -> scan_status != __rkpStream_scan_noFound
+            || (rkps -> cold -> scan_state != rkpRule_offset(rkpRule_state_root)
+            && rkps -> cold -> scan_state != rkpRule_offset(rkpRule_state_lineBegin))
+            || rkps -> cold -> scan_framing != __rkpStream_framing_none || rkps -> cold -> scan_contentLength_reading != 0))
+        return;
+    // waiting 和 body 之后总是从一个请求的开头重新扫描
+    rkps -> scan_midLine = rkps -> status != __rkpStream_waiting && rkps -> status != __rkpStream_body
+            && rkps -> cold -> scan_state == rkpRule_offset(rkpRule_state_root);
+    list_del_init(&rkps -> cold -> held);
+    rkpFree(rkps -> cold);
+    rkps -> cold = 0;
+}
+void __rkpStream_track(struct rkpStream* rkps)
+{
+    rkpStat_inc(flows);
+    trace_rkp_stream_new(rkps -> id);
+    if(static_branch_unlikely(&rkpSetting_record))
+        rkpRecord_stream(rkpRecord_event_new, rkps -> id, 0);
+}
\ No newline at end of file
@@ -0,0 +1,458 @@
+#pragma once
+#include "common.h"
+#include <kunit/test.h>
+
+// KUnit 测试，由 xmurp-ua-test.c 单独编译成 xmurp-ua-test.ko（见 Kconfig 中的 XMURP_UA_KUNIT_TEST），不包含在 xmurp-ua.ko 中。
+// 测试模块自己带着一份 src 下的全部代码（只有一个编译单元），计数、内存用量等都是它自己的，不会影响正在运行的 xmurp-ua.ko。
+// 用构造的包检查扫描、修改和计算校验和的结果，同时测量它们的耗时，用 kunit_info 输出。耗时只在结果正确时有意义。
+// 每一项都在序列号 2^31 和 2^32 附近各测一遍，让包跨过回绕的位置。64 位的除法都用 div_u64，OpenWrt 的很多目标是 32 位的。
+// tools/rkpGen -B 在用户态依次运行这些用例（不调用 rkpTest_init，使用 librkp 已经初始化好的规则）。
+
+#define rkpTest_rounds 200
+static const u_int32_t rkpTest_seq[] = {0x7FFFFFF0, 0xFFFFFFF0};
+
+int rkpTest_init(struct kunit*);                    // 每个用例之前初始化规则和内存计数，之后由 rkpTest_exit 释放
+void rkpTest_exit(struct kunit*);
+
+void rkpTest_scan(struct kunit*);                   // 把请求在每一个可能的位置切成两个包，依次扫描，检查找到的 UA 的位置
+void rkpTest_modify(struct kunit*);                 // 用不同的分段大小修改整个请求，检查修改后的内容
+void rkpTest_modify_retransmit(struct kunit*);      // 修改在 UA 之前、与 UA 重叠、在 UA 之后的单个重传包
+void rkpTest_csum(struct kunit*);                   // 对不同长度的包重新计算校验和，检查 IP 和 TCP 的校验和都正确
+void rkpTest_insert_auto(struct kunit*);            // 按倒序把包插入 buff_disordered 那样的链表（最坏的情况），检查插入后按序列号排好
+void rkpTest_framing(struct kunit*);                // 检查 __rkpStream_scan_head 从不同的头部中得到的 body 的长度
+void rkpTest_midLine(struct kunit*);
+        // 把值中含有 "User-Agent: " 的头部在每一个可能的位置切成两个包，两个包之间释放并重新分配 cold，检查找到的是真正的 UA
+
+struct sk_buff* __rkpTest_skb(u_int32_t, const unsigned char*, unsigned);
+        // 构造一个 IPv4/TCP 的 skb，参数为序列号和应用层数据。data 指向 IP 头，和钩子函数中一样
+struct rkpPacket* __rkpTest_split(u_int32_t, const unsigned char*, unsigned, unsigned);
+        // 把一段数据按照最后一个参数指定的长度切成若干个包，串成一个链表。不计入截留的统计
+void __rkpTest_free(struct rkpPacket*);             // 释放 __rkpTest_split 生成的链表
+unsigned __rkpTest_request(unsigned char*, unsigned*, unsigned*);
+        // 写入一个测试用的请求，返回长度；后两个参数返回 UA 的值的开始和结束（\r\n 处）的偏移
+
+static struct kunit_case rkpTest_cases[] =
+{
+    KUNIT_CASE(rkpTest_scan),
+    KUNIT_CASE(rkpTest_modify),
+    KUNIT_CASE(rkpTest_modify_retransmit),
+    KUNIT_CASE(rkpTest_csum),
+    KUNIT_CASE(rkpTest_insert_auto),
+    KUNIT_CASE(rkpTest_framing),
+    KUNIT_CASE(rkpTest_midLine),
+    {}
+};
+static struct kunit_suite rkpTest_suite =
+{
+    .name = "xmurp-ua",
+    .init = rkpTest_init,
+    .exit = rkpTest_exit,
+    .test_cases = rkpTest_cases
+};
+
+int rkpTest_init(struct kunit* test)
+{
+    int ret;
+    memcpy(str_uaRkp, "RKP/99.0", 9);
+    ret = rkpRule_init();
+    if(ret)
+        return ret;
+    ret = rkpMem_init();
+    if(ret)
+        rkpRule_exit();
+    return ret;
+}
+void rkpTest_exit(struct kunit* test)
+{
+    rkpMem_exit();
+    rkpRule_exit();
+}
+
+void rkpTest_scan(struct kunit* test)
+{
+    unsigned char buff[256];
+    unsigned ua_begin, ua_end, len = __rkpTest_request(buff, &ua_begin, &ua_end), i, split, round;
+    for(i = 0; i < sizeof(rkpTest_seq) / sizeof(rkpTest_seq[0]); i++)
+    {
+        u_int32_t seq = rkpTest_seq[i];
+        u_int64_t ns = 0;
+        for(split = 1; split < len; split++)
+        {
+            struct rkpPacket* rkppl = __rkpTest_split(seq, buff, split, split);
+            struct rkpPacket* rkppl2 = rkppl == 0 ? 0 : __rkpTest_split(seq + split, buff + split, len - split, len);
+            struct rkpStream rkps;
+            if(rkppl2 == 0)
+            {
+                __rkpTest_free(rkppl);
+                KUNIT_FAIL(test, "out of memory");
+                return;
+            }
+            rkppl -> next = rkppl2;
+            rkppl2 -> prev = rkppl;
+            // 用栈上的流，不经过 rkpManager，也不计入 flows
+            rkpStream_init(&rkps, rkppl);
+            if(!__rkpStream_cold_get(&rkps))
+            {
+                __rkpTest_free(rkppl);
+                KUNIT_FAIL(test, "out of memory");
+                return;
+            }
+            for(round = 0; round < rkpTest_rounds; round++)
+            {
+                struct rkpPacket* rkpp;
+                u_int64_t t;
+                __rkpStream_reset(&rkps);
+                t = ktime_get_ns();
+                for(rkpp = rkppl; rkpp != 0; rkpp = rkpp -> next)
+                {
+                    __rkpStream_scan(&rkps, rkpp, 0);
+                    if(rkps.cold -> scan_status == __rkpStream_scan_uaEnd)
+                        break;
+                }
+                ns += ktime_get_ns() - t;
+            }
+            KUNIT_EXPECT_EQ(test, (unsigned)rkps.cold -> scan_status, (unsigned)__rkpStream_scan_uaEnd);
+            KUNIT_EXPECT_EQ(test, (u_int32_t)rkps.cold -> scan_uaBegin_seq, (u_int32_t)(seq + ua_begin));
+            KUNIT_EXPECT_EQ(test, (u_int32_t)rkps.cold -> scan_uaEnd_seq, (u_int32_t)(seq + ua_end));
+            rkpStream_release(&rkps);
+            __rkpTest_free(rkppl);
+            cond_resched();
+        }
+        kunit_info(test, "seq 0x%08x: len %u splits %u ns_per_request %llu ns_per_byte %llu\n", seq, len, len - 1,
+                (unsigned long long)div_u64(ns, (len - 1) * rkpTest_rounds), (unsigned long long)div_u64(ns, (len - 1) * rkpTest_rounds * len));
+    }
+}
+
+void rkpTest_modify(struct kunit* test)
+{
+    const unsigned len_seg[] = {8, 64, 1460};
+    unsigned char buff[256], want[256];
+    unsigned ua_begin, ua_end, len = __rkpTest_request(buff, &ua_begin, &ua_end), i, j, k, round;
+    for(i = 0; i < sizeof(rkpTest_seq) / sizeof(rkpTest_seq[0]); i++)
+    {
+        u_int32_t seq = rkpTest_seq[i];
+        struct rkpMap* rkpm = rkpMap_new(seq + ua_begin, seq + ua_end, 0);
+        if(rkpm == 0)
+        {
+            KUNIT_FAIL(test, "out of memory");
+            return;
+        }
+        memcpy(want, buff, len);
+        for(j = ua_begin; j < ua_end; j++)
+            want[j] = __rkpMap_map(rkpm, j - ua_begin);
+        for(j = 0; j < sizeof(len_seg) / sizeof(len_seg[0]); j++)
+        {
+            struct rkpPacket *rkppl = __rkpTest_split(seq, buff, len, len_seg[j]), *rkpp;
+            u_int64_t ns = 0;
+            if(rkppl == 0)
+            {
+                rkpMap_delete(rkpm);
+                KUNIT_FAIL(test, "out of memory");
+                return;
+            }
+            for(round = 0; round < rkpTest_rounds; round++)
+            {
+                u_int64_t t = ktime_get_ns();
+                rkpMap_modify(&rkpm, &rkppl);
+                ns += ktime_get_ns() - t;
+            }
+            for(rkpp = rkppl, k = 0; rkpp != 0; k += rkpPacket_appLen(rkpp), rkpp = rkpp -> next)
+                KUNIT_EXPECT_EQ(test, memcmp(rkpPacket_appBegin(rkpp), want + k, rkpPacket_appLen(rkpp)), 0);
+            __rkpTest_free(rkppl);
+            kunit_info(test, "seq 0x%08x: segment %u ns %llu\n", seq, len_seg[j], (unsigned long long)div_u64(ns, rkpTest_rounds));
+        }
+        rkpMap_delete(rkpm);
+        cond_resched();
+    }
+}
+
+void rkpTest_modify_retransmit(struct kunit* test)
+{
+    unsigned char buff[256], want[256];
+    unsigned ua_begin, ua_end, len = __rkpTest_request(buff, &ua_begin, &ua_end), i, j, round;
+    // [0, ua_begin)、[ua_begin - 8, ua_begin + 8)、[ua_end, len)
+    const unsigned begin[] = {0, ua_begin - 8, ua_end}, end[] = {ua_begin, ua_begin + 8, len};
+    const char* name[] = {"before", "overlap", "after"};
+    for(i = 0; i < sizeof(rkpTest_seq) / sizeof(rkpTest_seq[0]); i++)
+    {
+        u_int32_t seq = rkpTest_seq[i];
+        struct rkpMap* rkpm = rkpMap_new(seq + ua_begin, seq + ua_end, 0);
+        if(rkpm == 0)
+        {
+            KUNIT_FAIL(test, "out of memory");
+            return;
+        }
+        memcpy(want, buff, len);
+        for(j = ua_begin; j < ua_end; j++)
+            want[j] = __rkpMap_map(rkpm, j - ua_begin);
+        for(j = 0; j < 3; j++)
+        {
+            struct rkpPacket* rkpp = __rkpTest_split(seq + begin[j], buff + begin[j], end[j] - begin[j], 1460);
+            u_int64_t ns = 0;
+            if(rkpp == 0)
+            {
+                rkpMap_delete(rkpm);
+                KUNIT_FAIL(test, "out of memory");
+                return;
+            }
+            for(round = 0; round < rkpTest_rounds; round++)
+            {
+                u_int64_t t = ktime_get_ns();
+                rkpMap_modify(&rkpm, &rkpp);
+                ns += ktime_get_ns() - t;
+            }
+            KUNIT_EXPECT_EQ(test, memcmp(rkpPacket_appBegin(rkpp), want + begin[j], end[j] - begin[j]), 0);
+            __rkpTest_free(rkpp);
+            kunit_info(test, "seq 0x%08x: retransmit %s ns %llu\n", seq, name[j], (unsigned long long)div_u64(ns, rkpTest_rounds));
+        }
+        rkpMap_delete(rkpm);
+        cond_resched();
+    }
+}
+
+void rkpTest_csum(struct kunit* test)
+{
+    const unsigned len[] = {64, 512, 1460};
+    unsigned char* buff = kmalloc(1460, GFP_KERNEL);
+    unsigned i, j, round;
+    if(buff == 0)
+    {
+        KUNIT_FAIL(test, "out of memory");
+        return;
+    }
+    for(i = 0; i < 1460; i++)
+        buff[i] = 'a' + i % 26;
+    for(i = 0; i < sizeof(rkpTest_seq) / sizeof(rkpTest_seq[0]); i++)
+        for(j = 0; j < sizeof(len) / sizeof(len[0]); j++)
+        {
+            struct rkpPacket* rkpp = __rkpTest_split(rkpTest_seq[i], buff, len[j], len[j]);
+            struct iphdr* iph;
+            u_int64_t ns = 0;
+            if(rkpp == 0)
+            {
+                kfree(buff);
+                KUNIT_FAIL(test, "out of memory");
+                return;
+            }
+            for(round = 0; round < rkpTest_rounds; round++)
+            {
+                u_int64_t t = ktime_get_ns();
+                rkpPacket_csum(rkpp);
+                ns += ktime_get_ns() - t;
+            }
+            iph = ip_hdr(rkpp -> skb);
+            KUNIT_EXPECT_EQ(test, (unsigned)ip_fast_csum((unsigned char*)iph, iph -> ihl), 0u);
+            KUNIT_EXPECT_EQ(test, (unsigned)csum_tcpudp_magic(iph -> saddr, iph -> daddr, ntohs(iph -> tot_len) - iph -> ihl * 4, IPPROTO_TCP,
+                    skb_checksum(rkpp -> skb, iph -> ihl * 4, ntohs(iph -> tot_len) - iph -> ihl * 4, 0)), 0u);
+            __rkpTest_free(rkpp);
+            kunit_info(test, "seq 0x%08x: len %u ns %llu\n", rkpTest_seq[i], len[j], (unsigned long long)div_u64(ns, rkpTest_rounds));
+        }
+    kfree(buff);
+}
+
+void rkpTest_insert_auto(struct kunit* test)
+{
+    const unsigned n = 32, len_seg = 16;
+    unsigned char buff[32 * 16];
+    struct rkpPacket* rkpps[32];
+    unsigned i, j;
+    memset(buff, 'x', sizeof(buff));
+    for(i = 0; i < sizeof(rkpTest_seq) / sizeof(rkpTest_seq[0]); i++)
+    {
+        u_int32_t seq = rkpTest_seq[i];
+        struct rkpPacket *rkppl = __rkpTest_split(seq, buff, n * len_seg, len_seg), *rkpp, *sorted = 0;
+        u_int64_t t;
+        if(rkppl == 0)
+        {
+            KUNIT_FAIL(test, "out of memory");
+            return;
+        }
+        for(j = 0, rkpp = rkppl; rkpp != 0; j++, rkpp = rkpp -> next)
+            rkpps[j] = rkpp;
+        for(j = 0; j < n; j++)
+            rkpps[j] -> prev = rkpps[j] -> next = 0;
+        t = ktime_get_ns();
+        for(j = n; j > 0; j--)
+            rkpPacket_insert_auto(&sorted, rkpps[j - 1], seq);
+        t = ktime_get_ns() - t;
+        for(j = 0, rkpp = sorted; rkpp != 0 && j < n; j++, rkpp = rkpp -> next)
+            KUNIT_EXPECT_TRUE(test, rkpp == rkpps[j]);
+        KUNIT_EXPECT_EQ(test, rkpPacket_num(&sorted), n);
+        // 插入时计入了截留的统计，取出时要再减掉
+        while(sorted != 0)
+        {
+            rkpp = rkpPacket_pop_begin(&sorted);
+            consume_skb(rkpp -> skb);
+            rkpPacket_delete(rkpp);
+        }
+        kunit_info(test, "seq 0x%08x: packets %u ns_per_packet %llu\n", seq, n, (unsigned long long)div_u64(t, n));
+    }
+}
+
+void rkpTest_framing(struct kunit* test)
+{
+    static const struct
+    {
+        const char* head;
+        u_int8_t framing;
+        u_int32_t contentLength;
+    } cases[] =
+    {
+        {"Host: a\r\n\r\n", __rkpStream_framing_none, 0},
+        {"Content-Length: 12\r\n\r\n", __rkpStream_framing_length, 12},
+        {"content-length:\t 0\r\n\r\n", __rkpStream_framing_length, 0},
+        {"Content-Length:\r\n\r\n", __rkpStream_framing_unknown, 0},
+        {"Content-Length:  \r\n\r\n", __rkpStream_framing_unknown, 0},
+        {"Content-Length: abc\r\n\r\n", __rkpStream_framing_unknown, 0},
+        {"Content-Length: 5\r\nContent-Length: 5\r\n\r\n", __rkpStream_framing_unknown, 0},
+        {"Content-Length: 99999999999\r\n\r\n", __rkpStream_framing_unknown, 0},
+        {"Transfer-Encoding: chunked\r\n\r\n", __rkpStream_framing_unknown, 0}
+    };
+    unsigned i;
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        struct rkpStream_cold cold;
+        const unsigned char* p = (const unsigned char*)cases[i].head;
+        // 与 __rkpStream_scan 中一样逐字节走自动机，只是每个字节都交给 __rkpStream_scan_head
+        unsigned state = rkpRule_offset(rkpRule_state_lineBegin), match = rkpRule_match_none;
+        cold.scan_framing = __rkpStream_framing_none;
+        cold.scan_contentLength = 0;
+        cold.scan_contentLength_reading = 0;
+        for(; *p != 0 && match != rkpRule_match_headEnd; p++)
+        {
+            state = rkpRule_next[state + rkpRule_class[*p]];
+            match = __rkpStream_scan_head(&cold, state, *p);
+        }
+        KUNIT_EXPECT_EQ(test, match, (unsigned)rkpRule_match_headEnd);
+        KUNIT_EXPECT_EQ(test, (unsigned)cold.scan_framing, (unsigned)cases[i].framing);
+        if(cases[i].framing == __rkpStream_framing_length)
+            KUNIT_EXPECT_EQ(test, (u_int32_t)cold.scan_contentLength, cases[i].contentLength);
+    }
+}
+
+void rkpTest_midLine(struct kunit* test)
+{
+    const char* head = "GET / HTTP/1.1\r\nX-Foo: User-Agent: fakevalue\r\nUser-Agent: ";
+    const char* tail = "Mozilla/5.0\r\n\r\n";
+    unsigned char buff[128];
+    unsigned ua_begin = strlen(head), len = ua_begin + strlen(tail), i, split;
+    memcpy(buff, head, ua_begin);
+    memcpy(buff + ua_begin, tail, len - ua_begin);
+    for(i = 0; i < sizeof(rkpTest_seq) / sizeof(rkpTest_seq[0]); i++)
+    {
+        u_int32_t seq = rkpTest_seq[i];
+        for(split = 1; split < len; split++)
+        {
+            struct rkpPacket* rkppl = __rkpTest_split(seq, buff, split, split);
+            struct rkpPacket* rkppl2 = rkppl == 0 ? 0 : __rkpTest_split(seq + split, buff + split, len - split, len);
+            struct rkpStream rkps;
+            if(rkppl2 == 0)
+            {
+                __rkpTest_free(rkppl);
+                KUNIT_FAIL(test, "out of memory");
+                return;
+            }
+            rkpStream_init(&rkps, rkppl);
+            // 和 __rkpStream_execute 一样，处理完一个包后尝试释放 cold，处理下一个包前再分配
+            if(__rkpStream_cold_get(&rkps))
+            {
+                __rkpStream_scan(&rkps, rkppl, 0);
+                __rkpStream_cold_put(&rkps);
+            }
+            if(__rkpStream_cold_get(&rkps) && rkps.cold -> scan_status != __rkpStream_scan_uaEnd)
+                __rkpStream_scan(&rkps, rkppl2, 0);
+            if(rkps.cold == 0)
+                KUNIT_FAIL(test, "out of memory");
+            else
+            {
+                KUNIT_EXPECT_EQ_MSG(test, (unsigned)rkps.cold -> scan_status, (unsigned)__rkpStream_scan_uaEnd, "split %u", split);
+                KUNIT_EXPECT_EQ_MSG(test, (u_int32_t)rkps.cold -> scan_uaBegin_seq, (u_int32_t)(seq + ua_begin), "split %u", split);
+            }
+            rkpStream_release(&rkps);
+            __rkpTest_free(rkppl);
+            __rkpTest_free(rkppl2);
+        }
+    }
+}
+
+struct sk_buff* __rkpTest_skb(u_int32_t seq, const unsigned char* data, unsigned len)
+{
+    struct sk_buff* skb = alloc_skb(40 + len, GFP_KERNEL);
+    struct iphdr* iph;
+    struct tcphdr* tcph;
+    if(skb == 0)
+        return 0;
+    skb_put(skb, 40 + len);
+    skb_reset_network_header(skb);
+    skb_set_transport_header(skb, 20);
+    iph = ip_hdr(skb);
+    memset(iph, 0, 40);
+    iph -> version = 4;
+    iph -> ihl = 5;
+    iph -> tot_len = htons(40 + len);
+    iph -> ttl = 64;
+    iph -> protocol = IPPROTO_TCP;
+    iph -> saddr = htonl((192 << 24) | (168 << 16) | 2);
+    iph -> daddr = htonl((10 << 24) | 1);
+    tcph = tcp_hdr(skb);
+    tcph -> source = htons(40000);
+    tcph -> dest = htons(80);
+    tcph -> seq = htonl(seq);
+    tcph -> doff = 5;
+    tcph -> ack = 1;
+    memcpy((unsigned char*)tcph + 20, data, len);
+    return skb;
+}
+struct rkpPacket* __rkpTest_split(u_int32_t seq, const unsigned char* data, unsigned len, unsigned len_seg)
+{
+    struct rkpPacket *rkppl = 0, *last = 0;
+    unsigned i;
+    for(i = 0; i < len; i += len_seg)
+    {
+        unsigned n = len - i < len_seg ? len - i : len_seg;
+        struct sk_buff* skb = __rkpTest_skb(seq + i, data + i, n);
+        struct rkpPacket* rkpp = skb == 0 ? 0 : rkpPacket_new(skb, false);
+        if(rkpp == 0)
+        {
+            if(skb != 0)
+                consume_skb(skb);
+            __rkpTest_free(rkppl);
+            return 0;
+        }
+        if(last == 0)
+            rkppl = rkpp;
+        else
+        {
+            last -> next = rkpp;
+            rkpp -> prev = last;
+        }
+        last = rkpp;
+    }
+    return rkppl;
+}
+void __rkpTest_free(struct rkpPacket* rkpp)
+{
+    while(rkpp != 0)
+    {
+        struct rkpPacket* rkpp2 = rkpp -> next;
+        consume_skb(rkpp -> skb);
+        rkpPacket_delete(rkpp);
+        rkpp = rkpp2;
+    }
+}
+unsigned __rkpTest_request(unsigned char* buff, unsigned* ua_begin, unsigned* ua_end)
+{
+    const char* head = "GET /index.html HTTP/1.1\r\nHost: example.com\r\nUser-Agent: ";
+    const char* ua = "Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101";
+    const char* tail = "\r\nAccept: */*\r\nConnection: keep-alive\r\n\r\n";
+    unsigned len = 0;
+    memcpy(buff + len, head, strlen(head));
+    len += strlen(head);
+    *ua_begin = len;
+    memcpy(buff + len, ua, strlen(ua));
+    len += strlen(ua);
+    *ua_end = len;
+    memcpy(buff + len, tail, strlen(tail));
+    len += strlen(tail);
+    return len;
+}
@@ -0,0 +1,134 @@
+// 跟踪点。由 common.h 在所有内核头文件之后包含，并在包含之前定义 CREATE_TRACE_POINTS。
+// 启用后输出到 ftrace 的环形缓冲区，例如：
+//      echo 1 > /sys/kernel/debug/tracing/events/xmurp_ua/enable
+//      cat /sys/kernel/debug/tracing/trace_pipe
+#undef TRACE_SYSTEM
+#ifdef RKP_TEST
+#define TRACE_SYSTEM xmurp_ua_test              // KUnit 测试模块自己也带着一份跟踪点，不能和 xmurp-ua.ko 的重名
+#else
+#define TRACE_SYSTEM xmurp_ua
+#endif
+
+#if !defined(_RKP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _RKP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#define rkpTrace_status_symbols                 \
+    {0, "sniffing_uaBegin"},                    \
+    {1, "sniffing_uaEnd"},                      \
+    {2, "waiting"},                             \
+    {3, "sniffing_headEnd"},                    \
+    {4, "body"}
+#define rkpTrace_scan_symbols                   \
+    {0, "noFound"},                             \
+    {1, "uaBegin"},                             \
+    {2, "uaRealBegin"},                         \
+    {3, "uaEnd"},                               \
+    {4, "uaGood"},                              \
+    {5, "headEnd"},                             \
+    {6, "uaDone"}
+#define rkpTrace_verdict_symbols                \
+    {NF_DROP, "NF_DROP"},                       \
+    {NF_ACCEPT, "NF_ACCEPT"},                   \
+    {NF_STOLEN, "NF_STOLEN"}
+
+DECLARE_EVENT_CLASS(rkp_stream,
+    TP_PROTO(const u_int32_t* id),
+    TP_ARGS(id),
+    TP_STRUCT__entry(
+        __array(u_int32_t, id, 3)
+    ),
+    TP_fast_assign(
+        memcpy(__entry -> id, id, sizeof(__entry -> id));
+    ),
+    TP_printk("%pI4h:%u -> %pI4h:%u",
+        &__entry -> id[0], __entry -> id[2] >> 16, &__entry -> id[1], __entry -> id[2] & 0xFFFF)
+);
+DEFINE_EVENT(rkp_stream, rkp_stream_new,
+    TP_PROTO(const u_int32_t* id),
+    TP_ARGS(id)
+);
+DEFINE_EVENT(rkp_stream, rkp_stream_delete,
+    TP_PROTO(const u_int32_t* id),
+    TP_ARGS(id)
+);
+
+TRACE_EVENT(rkp_stream_scan,
+    TP_PROTO(const u_int32_t* id, u_int32_t seq, unsigned status, unsigned scan_status, u_int32_t uaBegin_seq, u_int32_t uaEnd_seq, bool psh),
+    TP_ARGS(id, seq, status, scan_status, uaBegin_seq, uaEnd_seq, psh),
+    TP_STRUCT__entry(
+        __array(u_int32_t, id, 3)
+        __field(u_int32_t, seq)
+        __field(u_int8_t, status)
+        __field(u_int8_t, scan_status)
+        __field(bool, psh)
+        __field(u_int32_t, uaBegin_seq)
+        __field(u_int32_t, uaEnd_seq)
+    ),
+    TP_fast_assign(
+        memcpy(__entry -> id, id, sizeof(__entry -> id));
+        __entry -> seq = seq;
+        __entry -> status = status;
+        __entry -> scan_status = scan_status;
+        __entry -> psh = psh;
+        __entry -> uaBegin_seq = uaBegin_seq;
+        __entry -> uaEnd_seq = uaEnd_seq;
+    ),
+    TP_printk("%pI4h:%u seq=%u status=%s scan=%s psh=%d ua=[%u,%u)",
+        &__entry -> id[0], __entry -> id[2] >> 16, __entry -> seq,
+        __print_symbolic(__entry -> status, rkpTrace_status_symbols),
+        __print_symbolic(__entry -> scan_status, rkpTrace_scan_symbols),
+        __entry -> psh, __entry -> uaBegin_seq, __entry -> uaEnd_seq)
+);
+
+TRACE_EVENT(rkp_stream_verdict,
+    TP_PROTO(const u_int32_t* id, u_int32_t seq, unsigned len, bool ack, unsigned status, unsigned verdict),
+    TP_ARGS(id, seq, len, ack, status, verdict),
+    TP_STRUCT__entry(
+        __array(u_int32_t, id, 3)
+        __field(u_int32_t, seq)
+        __field(u_int16_t, len)
+        __field(bool, ack)
+        __field(u_int8_t, status)
+        __field(u_int8_t, verdict)
+    ),
+    TP_fast_assign(
+        memcpy(__entry -> id, id, sizeof(__entry -> id));
+        __entry -> seq = seq;
+        __entry -> len = len;
+        __entry -> ack = ack;
+        __entry -> status = status;
+        __entry -> verdict = verdict;
+    ),
+    TP_printk("%pI4h:%u seq=%u len=%u ack=%d status=%s %s",
+        &__entry -> id[0], __entry -> id[2] >> 16, __entry -> seq, __entry -> len, __entry -> ack,
+        __print_symbolic(__entry -> status, rkpTrace_status_symbols),
+        __print_symbolic(__entry -> verdict, rkpTrace_verdict_symbols))
+);
+
+TRACE_EVENT(rkp_map_modify,
+    TP_PROTO(int32_t begin, int32_t length, u_int32_t seq, unsigned len),
+    TP_ARGS(begin, length, seq, len),
+    TP_STRUCT__entry(
+        __field(int32_t, begin)
+        __field(int32_t, length)
+        __field(u_int32_t, seq)
+        __field(u_int16_t, len)
+    ),
+    TP_fast_assign(
+        __entry -> begin = begin;
+        __entry -> length = length;
+        __entry -> seq = seq;
+        __entry -> len = len;
+    ),
+    TP_printk("map=[%u,+%d) packet=[%u,+%u)",
+        (u_int32_t)__entry -> begin, __entry -> length, __entry -> seq, __entry -> len)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE rkpTrace
+#include <trace/define_trace.h>
@@ -0,0 +1,10 @@
+// KUnit 测试模块，用例见 rkpTest.h。和 xmurp-ua.c 一样只有一个编译单元，包含了模块的全部代码
+#define RKP_TEST
+#include "common.h"
+#include "rkpTest.h"
+
+kunit_test_suite(rkpTest_suite);
+
+MODULE_AUTHOR("Haonan Chen");
+MODULE_DESCRIPTION("KUnit tests for xmurp-ua.");
+MODULE_LICENSE("GPL");
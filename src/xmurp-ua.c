@@ -1,35 +1,456 @@
 #include "common.h"
+#include <linux/uaccess.h>
 
 static struct nf_hook_ops nfho[3];		// 需要在 INPUT、OUTPUT、FORWARD 各挂一个
-static struct rkpManager* rkpm;
+
+struct rkpNet
+// 每个网络命名空间各自的数据，通过 net_generic 取得
+{
+	struct rkpManager* rkpm;
+	struct proc_dir_entry* proc;		// 这个命名空间的 /proc/net/xmurp-ua
+};
+static unsigned rkpNet_id;
+static struct dentry* rkpDebugfs;		// debugfs 中的 xmurp-ua 目录
 
 unsigned int hook_funcion(void *priv, struct sk_buff *skb, const struct nf_hook_state *state)
 {
 	unsigned rtn;
+	struct rkpManager* rkpm;
+	u_int64_t t;
+	bool capture;
 
-	static unsigned n_skb_captured = 0, n_skb_captured_lastPrint = 1;
-
-	if(!rkpSetting_capture(skb))
+	// 计数记到这个命名空间中。还没有 rkpManager 的话（rkpNet_init 失败）记到模块的计数中
+	rkpm = ((struct rkpNet*)net_generic(state -> net, rkpNet_id)) -> rkpm;
+	rkpStat_inc_in(rkpm != 0 ? rkpm -> stat : &rkpStat_percpu, packet_seen);
+	t = rkpStat_stage_begin();
+	capture = rkpSetting_capture(skb);
+	rkpStat_stage_end(rkpStat_stage_capture, t);
+	if(!capture || rkpm == 0)
 		return NF_ACCEPT;
+	rkpStat_inc_in(rkpm -> stat, packet_captured);
 	rtn = rkpManager_execute(rkpm, skb);
 
-	n_skb_captured++;
-	if(n_skb_captured == n_skb_captured_lastPrint * 2)
+	if(rtn == NF_ACCEPT)
+		rkpStat_inc_in(rkpm -> stat, verdict_accept);
+	else if(rtn == NF_STOLEN)
+		rkpStat_inc_in(rkpm -> stat, verdict_stolen);
+	else if(rtn == NF_DROP)
+		rkpStat_inc_in(rkpm -> stat, verdict_drop);
+	return rtn;
+}
+
+static int rkpStat_show(struct seq_file* m, void* v)
+// /proc/net/xmurp-ua，每个命名空间中都有一个，只给出这个命名空间的计数。m -> private 是这个命名空间的 rkpManager
+{
+	struct rkpManager* rkpm = m -> private;
+	struct rkpStat rkpst;
+	rkpStat_sum(rkpm -> stat, &rkpst);
+	seq_printf(m, "packet_seen %lu\n", rkpst.packet_seen);
+	seq_printf(m, "packet_captured %lu\n", rkpst.packet_captured);
+	seq_printf(m, "verdict_accept %lu\n", rkpst.verdict_accept);
+	seq_printf(m, "verdict_stolen %lu\n", rkpst.verdict_stolen);
+	seq_printf(m, "verdict_drop %lu\n", rkpst.verdict_drop);
+	seq_printf(m, "ua_rewritten %lu\n", rkpst.ua_rewritten);
+	seq_printf(m, "ua_preserved %lu\n", rkpst.ua_preserved);
+	seq_printf(m, "rule_rewritten %lu\n", rkpst.rule_rewritten);
+	seq_printf(m, "rule_preserved %lu\n", rkpst.rule_preserved);
+	seq_printf(m, "disordered %lu\n", rkpst.disordered);
+	seq_printf(m, "retransmit %lu\n", rkpst.retransmit);
+	seq_printf(m, "lenUa_overflow %lu\n", rkpst.lenUa_overflow);
+	seq_printf(m, "malloc_failed %lu\n", rkpst.malloc_failed);
+	seq_printf(m, "budget_bypass %lu\n", rkpst.budget_bypass);
+	seq_printf(m, "budget_flush %lu\n", rkpst.budget_flush);
+	seq_printf(m, "shrink_evicted %lu\n", rkpst.shrink_evicted);
+	seq_printf(m, "shrink_flushed %lu\n", rkpst.shrink_flushed);
+	seq_printf(m, "hold_expired %lu\n", rkpst.hold_expired);
+	seq_printf(m, "stateless_handled %lu\n", rkpst.stateless_handled);
+	seq_printf(m, "stateless_promoted %lu\n", rkpst.stateless_promoted);
+	seq_printf(m, "stateless_demoted %lu\n", rkpst.stateless_demoted);
+	seq_printf(m, "stateless_evicted %lu\n", rkpst.stateless_evicted);
+	// 内存预算是整个模块共用的，占用的内存不区分命名空间，只在初始的命名空间中给出
+	if(rkpm == ((struct rkpNet*)net_generic(&init_net, rkpNet_id)) -> rkpm)
+		seq_printf(m, "mem_used %lld\n", (long long)percpu_counter_sum(&rkpMem_used));
+	seq_printf(m, "flows %ld\n", rkpst.flows);
+	seq_printf(m, "packets_held %ld\n", rkpst.packets_held);
+	seq_printf(m, "bytes_held %ld\n", rkpst.bytes_held);
+	return 0;
+}
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,18,0)
+static int rkpStat_open(struct inode* inode, struct file* file)
+{
+	return single_open(file, rkpStat_show, PDE_DATA(inode));
+}
+static const struct file_operations rkpStat_fops =
+{
+	.owner = THIS_MODULE,
+	.open = rkpStat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+#endif
+
+static int rkpStat_hold_show(struct seq_file* m, void* v)
+// debugfs 中的 xmurp-ua/hold_latency，截留时长的直方图
+{
+	const char* name[rkpStat_hold_n] = {"scan", "disordered"};
+	struct rkpStat_hold* rkpsth = kmalloc(sizeof(struct rkpStat_hold), GFP_KERNEL);
+	unsigned i, j;
+	if(rkpsth == 0)
+		return -ENOMEM;
+	rkpStat_hold_sum(rkpsth);
+	for(i = 0; i < rkpStat_hold_n; i++)
 	{
-		if(verbose)
-			printk("rkp-ua: Captured %d packets.\n", n_skb_captured);
-		n_skb_captured_lastPrint *= 2;
+		seq_printf(m, "%s max_ns %llu\n", name[i], (unsigned long long)rkpsth -> max[i]);
+		for(j = 0; j < rkpStat_hold_nBucket; j++)
+			if(rkpsth -> bucket[i][j] != 0)
+				seq_printf(m, "%s %llu %lu\n", name[i], j == 0 ? 0ull : 1ull << (j - 1), rkpsth -> bucket[i][j]);
 	}
-	return rtn;
+	kfree(rkpsth);
+	return 0;
+}
+static int rkpStat_hold_open(struct inode* inode, struct file* file)
+{
+	return single_open(file, rkpStat_hold_show, 0);
+}
+static const struct file_operations rkpStat_hold_fops =
+{
+	.owner = THIS_MODULE,
+	.open = rkpStat_hold_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+// debugfs 中的 xmurp-ua/profile，读取时输出各个阶段的累计耗时，写入 1 或 0 打开或关闭计时，写入 reset 清零
+static int rkpStat_stage_seq_show(struct seq_file* m, void* v)
+{
+	rkpStat_stage_show(m);
+	return 0;
+}
+static int rkpStat_stage_open(struct inode* inode, struct file* file)
+{
+	return single_open(file, rkpStat_stage_seq_show, 0);
+}
+static ssize_t rkpStat_stage_write(struct file* file, const char __user* buf, size_t len, loff_t* ppos)
+{
+	char cmd[8] = {0};
+	if(len == 0 || len >= sizeof(cmd))
+		return -EINVAL;
+	if(copy_from_user(cmd, buf, len))
+		return -EFAULT;
+	if(cmd[len - 1] == '\n')
+		cmd[len - 1] = 0;
+	if(strcmp(cmd, "1") == 0)
+		static_branch_enable(&rkpSetting_profile);
+	else if(strcmp(cmd, "0") == 0)
+		static_branch_disable(&rkpSetting_profile);
+	else if(strcmp(cmd, "reset") == 0)
+		rkpStat_stage_reset();
+	else
+		return -EINVAL;
+	return len;
+}
+static const struct file_operations rkpStat_stage_fops =
+{
+	.owner = THIS_MODULE,
+	.open = rkpStat_stage_open,
+	.read = seq_read,
+	.write = rkpStat_stage_write,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+// debugfs 中的 xmurp-ua/flows，列出所有流。
+// 迭代的位置为 rkpManager 的序号乘 256 再加上桶的序号，每次只对一个桶加锁并生成快照，最后一个位置输出汇总。
+// 整个过程中持有 rkpManager_list_mutex，保证 rkpManager 不会被释放，但不会一直持有 rkpManager 的锁。
+static struct rkpManager* rkpFlows_manager(unsigned n)
+{
+	struct rkpManager* rkpm;
+	list_for_each_entry(rkpm, &rkpManager_list, list)
+		if(n-- == 0)
+			return rkpm;
+	return 0;
 }
+static unsigned rkpFlows_nManager(void)
+{
+	struct rkpManager* rkpm;
+	unsigned n = 0;
+	list_for_each_entry(rkpm, &rkpManager_list, list)
+		n++;
+	return n;
+}
+static void* rkpFlows_start(struct seq_file* m, loff_t* pos)
+{
+	mutex_lock(&rkpManager_list_mutex);
+	if(*pos > rkpFlows_nManager() * 256)
+		return 0;
+	return (void*)(unsigned long)(*pos + 1);
+}
+static void* rkpFlows_next(struct seq_file* m, void* v, loff_t* pos)
+{
+	(*pos)++;
+	if(*pos > rkpFlows_nManager() * 256)
+		return 0;
+	return (void*)(unsigned long)(*pos + 1);
+}
+static void rkpFlows_stop(struct seq_file* m, void* v)
+{
+	mutex_unlock(&rkpManager_list_mutex);
+}
+static void rkpFlows_summary(struct seq_file* m)
+{
+	unsigned chain[9] = {0}, n_flow = 0, i, j;
+	struct rkpManager* rkpm;
+	struct rkpStat rkpst;
+	long packets_held = 0, bytes_held = 0;
+	list_for_each_entry(rkpm, &rkpManager_list, list)
+	{
+		for(i = 0; i < 256; i++)
+		{
+			j = rkpManager_snapshot(rkpm, i, 0, 0);
+			n_flow += j;
+			chain[j < 8 ? j : 8]++;
+		}
+		rkpStat_sum(rkpm -> stat, &rkpst);
+		packets_held += rkpst.packets_held;
+		bytes_held += rkpst.bytes_held;
+	}
+	seq_printf(m, "# flows %u, held %ld packets %ld bytes, chain length", n_flow, packets_held, bytes_held);
+	for(i = 0; i < 9; i++)
+		seq_printf(m, " %s%u:%u", i == 8 ? ">=" : "", i, chain[i]);
+	seq_puts(m, "\n");
+}
+static int rkpFlows_show(struct seq_file* m, void* v)
+{
+	unsigned pos = (unsigned long)v - 1, n, i;
+	struct rkpManager* rkpm;
+	struct rkpStream_info* info;
+	if(pos == 0)
+		seq_puts(m, "# manager client server status scan seq_offset scan_packets scan_bytes disordered_packets disordered_bytes maps mem idle_ms\n");
+	rkpm = rkpFlows_manager(pos / 256);
+	if(rkpm == 0)
+	{
+		rkpFlows_summary(m);
+		return 0;
+	}
+	n = rkpManager_snapshot(rkpm, pos % 256, 0, 0);
+	if(n == 0)
+		return 0;
+	info = kmalloc(sizeof(struct rkpStream_info) * n, GFP_KERNEL);
+	if(info == 0)
+		return -ENOMEM;
+	n = min(n, rkpManager_snapshot(rkpm, pos % 256, info, n));
+	for(i = 0; i < n; i++)
+		seq_printf(m, "%u %pI4h:%u %pI4h:%u %u %u %u %u %u %u %u %u %u %u\n", pos / 256,
+				&info[i].id[0], info[i].id[2] >> 16, &info[i].id[1], info[i].id[2] & 0xFFFF,
+				info[i].status, info[i].scan_status, (u_int32_t)info[i].seq_offset,
+				info[i].n_scan, info[i].bytes_scan, info[i].n_disordered, info[i].bytes_disordered,
+				info[i].n_map, info[i].mem, info[i].idle);
+	kfree(info);
+	return 0;
+}
+static const struct seq_operations rkpFlows_sops =
+{
+	.start = rkpFlows_start,
+	.next = rkpFlows_next,
+	.stop = rkpFlows_stop,
+	.show = rkpFlows_show
+};
+static int rkpFlows_open(struct inode* inode, struct file* file)
+{
+	return seq_open(file, &rkpFlows_sops);
+}
+static const struct file_operations rkpFlows_fops =
+{
+	.owner = THIS_MODULE,
+	.open = rkpFlows_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release
+};
+
+// 飞行记录器的 relay 通道，见 rkpRecord.h。在 debugfs 的 xmurp-ua 目录下每个 CPU 一个文件 record0、record1……
+#ifdef CONFIG_RELAY
+static struct dentry* rkpRecord_create_buf_file(const char* filename, struct dentry* parent, umode_t mode,
+		struct rchan_buf* buf, int* is_global)
+{
+	return debugfs_create_file(filename, 0400, parent, buf, &relay_file_operations);
+}
+static int rkpRecord_remove_buf_file(struct dentry* dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+static int rkpRecord_subbuf_start(struct rchan_buf* buf, void* subbuf, void* prev_subbuf, size_t prev_padding)
+{
+	// 总是切换到下一个子缓冲区，写满后覆盖最旧的记录，而不是停止记录
+	return 1;
+}
+static struct rchan_callbacks rkpRecord_callbacks =
+{
+	.subbuf_start = rkpRecord_subbuf_start,
+	.create_buf_file = rkpRecord_create_buf_file,
+	.remove_buf_file = rkpRecord_remove_buf_file
+};
+#endif
+static void rkpRecord_open(void)
+{
+#ifdef CONFIG_RELAY
+	// 分成 8 个子缓冲区，每个都是记录长度的整数倍
+	size_t size = (size_t)record * 1024 / 8 / sizeof(struct rkpRecord) * sizeof(struct rkpRecord);
+	if(size == 0)
+		return;
+	rkpRecord_chan = relay_open("record", rkpDebugfs, size, 8, &rkpRecord_callbacks, 0);
+	if(rkpRecord_chan == 0)
+	{
+		printk("rkp-ua: failed to create the flight recorder.\n");
+		return;
+	}
+	static_branch_enable(&rkpSetting_record);
+#endif
+}
+static void rkpRecord_close(void)
+{
+#ifdef CONFIG_RELAY
+	if(rkpRecord_chan == 0)
+		return;
+	static_branch_disable(&rkpSetting_record);
+	relay_close(rkpRecord_chan);
+	rkpRecord_chan = 0;
+#endif
+}
+
+// 内存紧张时，内核通过 shrinker 来要求模块释放一些流和截留的包
+static unsigned long rkpShrinker_count(struct shrinker* shrinker, struct shrink_control* sc)
+{
+	struct rkpManager* rkpm;
+	struct rkpStat rkpst;
+	long n = 0;
+	// 只报告 scan 真正能释放的东西：可以删除的流和截留的包。报告释放不了的流会让内核一直调用 scan
+	if(!mutex_trylock(&rkpManager_list_mutex))
+		return 0;
+	list_for_each_entry(rkpm, &rkpManager_list, list)
+	{
+		n += rkpManager_shrinkable(rkpm);
+		rkpStat_sum(rkpm -> stat, &rkpst);
+		n += rkpst.packets_held;
+	}
+	mutex_unlock(&rkpManager_list_mutex);
+#ifdef SHRINK_EMPTY
+	return n > 0 ? n : SHRINK_EMPTY;
+#else
+	return n > 0 ? n : 0;
+#endif
+}
+static unsigned long rkpShrinker_scan(struct shrinker* shrinker, struct shrink_control* sc)
+{
+	struct rkpManager* rkpm;
+	struct rkpStat __percpu* stat_outer;
+	unsigned long rtn = 0;
+	if(!mutex_trylock(&rkpManager_list_mutex))
+		return SHRINK_STOP;
+	list_for_each_entry(rkpm, &rkpManager_list, list)
+	{
+		struct rkpPacket* rkppl = 0;
+		if(rtn >= sc -> nr_to_scan)
+			break;
+		rtn += rkpManager_shrink(rkpm, sc -> nr_to_scan - rtn, &rkppl);
+		// 放出的包在 rkpManager 的锁之外发出，计数仍然记在它的命名空间中。关掉软中断，期间不会换 CPU
+		local_bh_disable();
+		stat_outer = rkpStat_enter(rkpm -> stat);
+		rkpPacket_sendl(&rkppl);
+		rkpStat_leave(stat_outer);
+		local_bh_enable();
+	}
+	mutex_unlock(&rkpManager_list_mutex);
+	return rtn > 0 ? rtn : SHRINK_STOP;
+}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+static struct shrinker* rkpShrinker;
+#else
+static struct shrinker rkpShrinker =
+{
+	.count_objects = rkpShrinker_count,
+	.scan_objects = rkpShrinker_scan,
+	.seeks = DEFAULT_SEEKS
+};
+#endif
+static int rkpShrinker_register(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	rkpShrinker = shrinker_alloc(0, "xmurp-ua");
+	if(rkpShrinker == 0)
+		return -ENOMEM;
+	rkpShrinker -> count_objects = rkpShrinker_count;
+	rkpShrinker -> scan_objects = rkpShrinker_scan;
+	shrinker_register(rkpShrinker);
+	return 0;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+	return register_shrinker(&rkpShrinker, "xmurp-ua");
+#else
+	return register_shrinker(&rkpShrinker);
+#endif
+}
+static void rkpShrinker_unregister(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	shrinker_free(rkpShrinker);
+#else
+	unregister_shrinker(&rkpShrinker);
+#endif
+}
+
+static int __net_init rkpNet_init(struct net* net)
+{
+	struct rkpNet* rkpn = net_generic(net, rkpNet_id);
+	rkpn -> rkpm = rkpManager_new();
+	if(rkpn -> rkpm == 0)
+		return -ENOMEM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0)
+	if(nf_register_net_hooks(net, nfho, 3))
+	{
+		printk("rkp-ua: nf_register_net_hooks failed.\n");
+		rkpManager_delete(rkpn -> rkpm);
+		rkpn -> rkpm = 0;
+		return -EINVAL;
+	}
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
+	rkpn -> proc = proc_create_single_data("xmurp-ua", 0444, net -> proc_net, rkpStat_show, rkpn -> rkpm);
+#else
+	rkpn -> proc = proc_create_data("xmurp-ua", 0444, net -> proc_net, &rkpStat_fops, rkpn -> rkpm);
+#endif
+	if(rkpn -> proc == 0)
+		printk("rkp-ua: failed to create /proc/net/xmurp-ua.\n");
+	return 0;
+}
+static void __net_exit rkpNet_exit(struct net* net)
+{
+	struct rkpNet* rkpn = net_generic(net, rkpNet_id);
+	if(rkpn -> rkpm == 0)
+		return;
+	proc_remove(rkpn -> proc);
+	rkpn -> proc = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0)
+	nf_unregister_net_hooks(net, nfho, 3);
+#endif
+	rkpManager_delete(rkpn -> rkpm);
+	rkpn -> rkpm = 0;
+}
+static struct pernet_operations rkpNet_ops =
+{
+	.init = rkpNet_init,
+	.exit = rkpNet_exit,
+	.id = &rkpNet_id,
+	.size = sizeof(struct rkpNet)
+};
 
 static int __init hook_init(void)
 {
 	int ret;
 	unsigned i;
 
-	rkpm = rkpManager_new();
-
 	memcpy(str_uaRkp, "RKP/", 4);
 	memcpy(str_uaRkp + 4, VERSION, 2);
 	memcpy(str_uaRkp + 6, ".0", 3);
@@ -43,21 +464,85 @@ static int __init hook_init(void)
 		nfho[i].pf = NFPROTO_IPV4;
 		nfho[i].priority = NF_IP_PRI_MANGLE + 1;
 	}
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0)
-    	ret = nf_register_net_hooks(&init_net, nfho, 3);
-#else
-    	ret = nf_register_hooks(nfho, 3);
+	if(verbose)
+		static_branch_enable(&rkpSetting_verbose);
+	if(debug)
+	{
+		// 调试信息都改成了跟踪点，打开 debug 时顺便把它们打开，输出到 ftrace 的缓冲区而不是控制台
+		static_branch_enable(&rkpSetting_debug);
+		trace_set_clr_event("xmurp_ua", 0, 1);
+	}
+	rkpStat_stage_init();
+	if(profile)
+		static_branch_enable(&rkpSetting_profile);
+
+	// 规则的替换值中有 str_uaRkp，需要在它设置好之后编译
+	ret = rkpRule_init();
+	if(ret)
+		return ret;
+	ret = rkpMem_init();
+	if(ret)
+	{
+		rkpRule_exit();
+		return ret;
+	}
+	ret = rkpCache_init();
+	if(ret)
+	{
+		rkpMem_exit();
+		rkpRule_exit();
+		return ret;
+	}
+
+	rkpDebugfs = debugfs_create_dir("xmurp-ua", 0);
+	debugfs_create_file("hold_latency", 0444, rkpDebugfs, 0, &rkpStat_hold_fops);
+	debugfs_create_file("flows", 0444, rkpDebugfs, 0, &rkpFlows_fops);
+	debugfs_create_file("profile", 0600, rkpDebugfs, 0, &rkpStat_stage_fops);
+	rkpRecord_open();
+
+	// 4.13 以后钩子是按命名空间注册的，在 rkpNet_init 中完成；之前的版本钩子是全局的，每个包再根据 state -> net 找到对应的 rkpManager
+	ret = register_pernet_subsys(&rkpNet_ops);
+	printk("rkp-ua: register_pernet_subsys returnd %d.\n", ret);
+	if(ret)
+	{
+		rkpRecord_close();
+		debugfs_remove_recursive(rkpDebugfs);
+		rkpCache_exit();
+		rkpMem_exit();
+		rkpRule_exit();
+		return ret;
+	}
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,13,0)
+	ret = nf_register_hooks(nfho, 3);
+	printk("rkp-ua: nf_register_hook returnd %d.\n", ret);
+	if(ret)
+	{
+		unregister_pernet_subsys(&rkpNet_ops);
+		rkpRecord_close();
+		debugfs_remove_recursive(rkpDebugfs);
+		rkpCache_exit();
+		rkpMem_exit();
+		rkpRule_exit();
+		return ret;
+	}
 #endif
 
+	if(rkpShrinker_register())
+		printk("rkp-ua: failed to register shrinker.\n");
+
 	printk("rkp-ua: Started, version %s\n", VERSION);
-	printk("rkp-ua: nf_register_hook returnd %d.\n", ret);
 	printk("rkp-ua: autocapture=%c, mark_capture=0x%x, mark_ack=0x%x\n",
 			'n' + autocapture * ('y' - 'n'), mark_capture, mark_ack);
 	printk("rkp-ua: str_preserve: %d\n", n_str_preserve);
 	for(ret = 0; ret < n_str_preserve; ret++)
 		printk("\t%s\n", str_preserve[ret]);
-	printk("rkp-ua: time_keepalive=%d, len_ua=%d\n", time_keepalive, len_ua);
-	printk("rkp-ua: verbose=%c, debug=%c\n", 'n' + verbose * ('y' - 'n'), 'n' + debug * ('y' - 'n'));
+	printk("rkp-ua: str_rule: %d\n", n_str_rule);
+	for(ret = 0; ret < n_str_rule; ret++)
+		printk("\t%s\n", str_rule[ret]);
+	printk("rkp-ua: time_keepalive=%d, len_ua=%d, mem_budget=%dKB, time_hold=%dms, record=%dKB, stateless=%c, stateless_cache=%u\n",
+			time_keepalive, len_ua, mem_budget, time_hold, record, 'n' + stateless * ('y' - 'n'), stateless_cache);
+	printk("rkp-ua: verbose=%c, debug=%c, profile=%c\n", 'n' + verbose * ('y' - 'n'), 'n' + debug * ('y' - 'n'),
+			'n' + profile * ('y' - 'n'));
 	printk("rkp-ua: str_preserve: %d\n", n_str_preserve);
 	printk("str_ua_rkp: %s\n", str_uaRkp);
 
@@ -66,13 +551,16 @@ static int __init hook_init(void)
 
 static void __exit hook_exit(void)
 {
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0)
-	nf_unregister_net_hooks(&init_net, nfho, 3);
-#else
+	rkpShrinker_unregister();
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,13,0)
 	nf_unregister_hooks(nfho, 3);
 #endif
-	if(rkpm != 0)
-		rkpManager_delete(rkpm);
+	unregister_pernet_subsys(&rkpNet_ops);
+	rkpRecord_close();
+	debugfs_remove_recursive(rkpDebugfs);
+	rkpCache_exit();
+	rkpMem_exit();
+	rkpRule_exit();
 	printk("rkp-ua: Stopped.\n");
 }
 
@@ -0,0 +1,281 @@
+#!/bin/bash
+# 在一台机器上用网络命名空间和 veth 搭建 客户端 - 路由器 - 服务端 的拓扑，测量加载 xmurp-ua 前后的请求速率、延迟和软中断占用的 CPU。
+# 不需要外部网络，需要 root、iproute2、iptables、taskset，客户端使用 wrk（没有的话使用 ab），服务端使用 nginx（没有的话使用 python3 -m http.server，可能成为瓶颈）。
+# 用法：rkpBench.sh [-k xmurp-ua.ko] [-b rkpBpf.o] [-u rkpNfq] [-d 秒数] [-c 连接数] [-n "1 4 all"] [-p "模块的其它参数"]
+#   没有 -k 时只测量不加载模块的情况。
+#   有 -u 时（不需要 -k）再测量一组用 tools/rkpNfq 在用户态处理的情况，每个核心一个队列，路由器的命名空间中用 NFQUEUE 的规则把 80 端口的包交给它。
+#   有 -b 时（需要同时指定 -k）再测量一组在路由器的 r0 上挂上 bpf/rkpBpf.c 的情况，这时去掉给发往 80 端口的包打 mark 的规则，由 eBPF 程序决定哪些包交给模块。
+#   模块以 autocapture=0 加载，只在路由器的命名空间中用 iptables 给包打 mark，客户端和服务端的命名空间中的包不会被处理。
+#   veth 上的包在发送方的 CPU 上以软中断处理，所以软中断的占用按客户端和服务端绑定的那些 CPU 统计。
+
+set -e
+
+ko=""
+bpf=""
+nfq=""
+duration=10
+connections=64
+cores_list="1 4 all"
+params=""
+ua="Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36"
+
+while getopts "k:b:u:d:c:n:p:" opt; do
+    case $opt in
+        k) ko=$OPTARG ;;
+        b) bpf=$OPTARG ;;
+        u) nfq=$OPTARG ;;
+        d) duration=$OPTARG ;;
+        c) connections=$OPTARG ;;
+        n) cores_list=$OPTARG ;;
+        p) params=$OPTARG ;;
+        *) echo "usage: $0 [-k xmurp-ua.ko] [-b rkpBpf.o] [-u rkpNfq] [-d seconds] [-c connections] [-n \"1 4 all\"] [-p \"module params\"]" >&2; exit 1 ;;
+    esac
+done
+
+if [ "$(id -u)" != 0 ]; then
+    echo "need root." >&2
+    exit 1
+fi
+if [ -n "$ko" ] && [ ! -f "$ko" ]; then
+    echo "$ko: not found." >&2
+    exit 1
+fi
+if [ -n "$bpf" ] && { [ -z "$ko" ] || [ ! -f "$bpf" ]; }; then
+    echo "-b needs -k and an existing $bpf." >&2
+    exit 1
+fi
+if [ -n "$nfq" ] && [ ! -x "$nfq" ]; then
+    echo "$nfq: not found." >&2
+    exit 1
+fi
+if lsmod | grep -q '^xmurp_ua '; then
+    echo "xmurp-ua is already loaded, unload it first." >&2
+    exit 1
+fi
+if command -v wrk >/dev/null; then
+    client=wrk
+elif command -v ab >/dev/null; then
+    client=ab
+else
+    echo "need wrk or ab." >&2
+    exit 1
+fi
+if command -v nginx >/dev/null; then
+    server=nginx
+else
+    server=python3
+    echo "nginx not found, using python3 -m http.server, which may be the bottleneck." >&2
+fi
+
+ns_c=rkpBench_client
+ns_r=rkpBench_router
+ns_s=rkpBench_server
+tmp=$(mktemp -d)
+server_pid=""
+nfq_pid=""
+loaded=0
+
+cleanup()
+{
+    [ -n "$server_pid" ] && kill "$server_pid" 2>/dev/null && wait "$server_pid" 2>/dev/null
+    [ -n "$nfq_pid" ] && kill "$nfq_pid" 2>/dev/null && wait "$nfq_pid" 2>/dev/null
+    [ "$loaded" = 1 ] && rmmod xmurp_ua
+    ip netns del $ns_c 2>/dev/null
+    ip netns del $ns_r 2>/dev/null
+    ip netns del $ns_s 2>/dev/null
+    rm -rf "$tmp"
+}
+trap cleanup EXIT
+
+setup()
+{
+    ip netns add $ns_c
+    ip netns add $ns_r
+    ip netns add $ns_s
+    ip link add c0 netns $ns_c type veth peer name r0 netns $ns_r
+    ip link add s0 netns $ns_s type veth peer name r1 netns $ns_r
+
+    # 客户端在 192.168.0.0/16 中，服务端在外面，和路由器上的实际情况一样
+    ip -n $ns_c addr add 192.168.1.2/24 dev c0
+    ip -n $ns_r addr add 192.168.1.1/24 dev r0
+    ip -n $ns_r addr add 10.0.0.1/24 dev r1
+    ip -n $ns_s addr add 10.0.0.2/24 dev s0
+    for ns in $ns_c $ns_r $ns_s; do
+        ip -n $ns link set lo up
+    done
+    ip -n $ns_c link set c0 up
+    ip -n $ns_r link set r0 up
+    ip -n $ns_r link set r1 up
+    ip -n $ns_s link set s0 up
+    ip -n $ns_c route add default via 192.168.1.1
+    ip -n $ns_s route add default via 10.0.0.1
+    ip netns exec $ns_r sysctl -qw net.ipv4.ip_forward=1
+
+    # 与 doc/useage.md 中 mark_capture、mark_ack 的示例相同。不加载模块时规则也保留，两种情况只差模块本身
+    ip netns exec $ns_r iptables -t mangle -A FORWARD -p tcp --dport 80 -j MARK --set-xmark 0x100/0x100
+    ip netns exec $ns_r iptables -t mangle -A FORWARD -p tcp --sport 80 --tcp-flags ACK ACK -j MARK --set-xmark 0x300/0x300
+}
+
+cpus_of()
+# 参数为核心数，输出 taskset 使用的 CPU 列表
+{
+    echo "0-$(($1 - 1))"
+}
+
+softirq_snapshot()
+# 参数为核心数，输出这些 CPU 的软中断时间和总时间
+{
+    awk -v n="$1" '$1 ~ /^cpu[0-9]+$/ && substr($1, 4) + 0 < n { s += $8; for(i = 2; i <= NF; i++) t += $i } END { print s, t }' /proc/stat
+}
+
+start_server()
+# 参数为核心数
+{
+    if [ $server = nginx ]; then
+        mkdir -p "$tmp/nginx"
+        cat > "$tmp/nginx/nginx.conf" <<EOF
+worker_processes $1;
+pid $tmp/nginx/nginx.pid;
+error_log $tmp/nginx/error.log;
+daemon off;
+events { worker_connections 4096; }
+http {
+    access_log off;
+    client_body_temp_path $tmp/nginx;
+    server {
+        listen 10.0.0.2:80 reuseport;
+        location / { return 200 "ok\n"; }
+    }
+}
+EOF
+        ip netns exec $ns_s taskset -c "$(cpus_of "$1")" nginx -c "$tmp/nginx/nginx.conf" -p "$tmp/nginx" &
+    else
+        echo ok > "$tmp/index.html"
+        (cd "$tmp" && exec ip netns exec $ns_s taskset -c "$(cpus_of "$1")" python3 -m http.server 80 --bind 10.0.0.2 >/dev/null 2>&1) &
+    fi
+    server_pid=$!
+    for _ in $(seq 50); do
+        ip netns exec $ns_c bash -c 'exec 3<>/dev/tcp/10.0.0.2/80' 2>/dev/null && return 0
+        sleep 0.1
+    done
+    echo "server did not start." >&2
+    exit 1
+}
+
+stop_server()
+{
+    kill "$server_pid" 2>/dev/null || true
+    wait "$server_pid" 2>/dev/null || true
+    server_pid=""
+}
+
+to_us()
+# 将 wrk 输出的 1.23ms、456.00us、1.20s 转换为微秒
+{
+    awk -v v="$1" 'BEGIN {
+        if(v ~ /us$/) printf "%.0f", v + 0;
+        else if(v ~ /ms$/) printf "%.0f", v * 1000;
+        else if(v ~ /s$/) printf "%.0f", v * 1000000;
+        else printf "%s", v }'
+}
+
+run()
+# 参数为标签和核心数，输出一行结果
+{
+    local label=$1 n=$2 out rps p50 p99 s0 t0 s1 t1 conn=$connections
+    [ "$conn" -lt "$n" ] && conn=$n
+    start_server "$n"
+    read -r s0 t0 < <(softirq_snapshot "$n")
+    if [ $client = wrk ]; then
+        out=$(ip netns exec $ns_c taskset -c "$(cpus_of "$n")" wrk -t "$n" -c "$conn" -d "${duration}s" --latency \
+                -H "User-Agent: $ua" http://10.0.0.2/)
+        rps=$(echo "$out" | awk '/^Requests\/sec:/ { printf "%.0f", $2 }')
+        p50=$(to_us "$(echo "$out" | awk '$1 == "50%" { print $2 }')")
+        p99=$(to_us "$(echo "$out" | awk '$1 == "99%" { print $2 }')")
+    else
+        out=$(ip netns exec $ns_c taskset -c "$(cpus_of "$n")" ab -q -k -c "$conn" -t "$duration" -n 100000000 \
+                -H "User-Agent: $ua" http://10.0.0.2/ 2>/dev/null)
+        rps=$(echo "$out" | awk '/^Requests per second:/ { printf "%.0f", $4 }')
+        p50=$(echo "$out" | awk '$1 == "50%" { print $2 * 1000 }')
+        p99=$(echo "$out" | awk '$1 == "99%" { print $2 * 1000 }')
+    fi
+    read -r s1 t1 < <(softirq_snapshot "$n")
+    stop_server
+    printf "%-8s %6s %10s %10s %10s %9s\n" "$label" "$n" "$rps" "$p50" "$p99" \
+            "$(awk -v s=$((s1 - s0)) -v t=$((t1 - t0)) 'BEGIN { printf "%.1f", t ? s * 100 / t : 0 }')"
+}
+
+run_nfq()
+# 参数为核心数，用同样多的队列运行 rkpNfq 后测量，输出一行结果
+{
+    local n=$1 target
+    if [ "$n" = 1 ]; then
+        target="--queue-num 0"
+    else
+        target="--queue-balance 0:$((n - 1))"
+    fi
+    # shellcheck disable=SC2086
+    ip netns exec $ns_r iptables -t mangle -I FORWARD -p tcp --dport 80 -j NFQUEUE $target --queue-bypass
+    # shellcheck disable=SC2086
+    ip netns exec $ns_r iptables -t mangle -I FORWARD -p tcp --sport 80 -j NFQUEUE $target --queue-bypass
+    # -p 是模块参数的格式，不传给 rkpNfq，它使用默认的参数
+    ip netns exec $ns_r "$nfq" -n "$n" -c 0 > "$tmp/nfq.$n" &
+    nfq_pid=$!
+    sleep 0.5
+    run nfq "$n"
+    kill -INT "$nfq_pid"
+    wait "$nfq_pid" || true
+    nfq_pid=""
+    # shellcheck disable=SC2086
+    ip netns exec $ns_r iptables -t mangle -D FORWARD -p tcp --dport 80 -j NFQUEUE $target --queue-bypass
+    # shellcheck disable=SC2086
+    ip netns exec $ns_r iptables -t mangle -D FORWARD -p tcp --sport 80 -j NFQUEUE $target --queue-bypass
+    nfq_rewritten=$((nfq_rewritten + $(awk '$1 == "ua_rewritten:" { print $2 }' "$tmp/nfq.$n")))
+}
+
+rewritten()
+{
+    awk '$1 == "ua_rewritten" { print $2 }' /proc/net/xmurp-ua 2>/dev/null || echo 0
+}
+
+setup
+nproc=$(nproc)
+cores=""
+for n in $cores_list; do
+    [ "$n" = all ] && n=$nproc
+    [ "$n" -le "$nproc" ] && cores="$cores $n"
+done
+
+echo "client: $client, server: $server, duration: ${duration}s, connections: $connections"
+printf "%-8s %6s %10s %10s %10s %9s\n" mode cores req/s p50_us p99_us softirq%
+for n in $cores; do
+    run base "$n"
+done
+if [ -n "$nfq" ]; then
+    nfq_rewritten=0
+    for n in $cores; do
+        run_nfq "$n"
+    done
+    echo "ua_rewritten by rkpNfq: $nfq_rewritten"
+fi
+if [ -n "$ko" ]; then
+    # shellcheck disable=SC2086
+    insmod "$ko" autocapture=0 $params
+    loaded=1
+    for n in $cores; do
+        run xmurp-ua "$n"
+    done
+    echo "ua_rewritten: $(rewritten)"
+    if [ -n "$bpf" ]; then
+        # 发往 80 端口的包由 eBPF 程序决定是否打 mark，服务端发回的包仍然由 iptables 打 mark
+        ip netns exec $ns_r iptables -t mangle -D FORWARD -p tcp --dport 80 -j MARK --set-xmark 0x100/0x100
+        ip netns exec $ns_r tc qdisc add dev r0 clsact
+        ip netns exec $ns_r tc filter add dev r0 ingress bpf direct-action obj "$bpf" sec tc
+        before=$(rewritten)
+        for n in $cores; do
+            run bpf "$n"
+        done
+        echo "ua_rewritten by xmurp-ua: $(($(rewritten) - before))"
+        command -v bpftool >/dev/null && ip netns exec $ns_r bpftool map dump name rkpBpf_stat || true
+    fi
+fi
@@ -0,0 +1,442 @@
+// 生成各种容易走到 rkpStream_execute 中代价较高的分支的 TCP/HTTP 数据流，直接交给 rkpManager 处理，输出每种场景的吞吐量和延迟。
+// 结果只取决于随机数种子和参数，相同的参数每次生成的包完全相同。
+// 用法：rkpGen [选项] [场景...]，不指定场景时运行全部场景
+//      -S n        随机数种子
+//      -f n        流的个数
+//      -q n        每个流中请求的个数
+//      -z a,b      分段大小在 [a, b] 中均匀分布
+//      -o p        与后一个包交换顺序的概率
+//      -x p        丢包的概率，丢掉的包会在之后重传
+//      -d p        重复发送的概率
+//      -u n        UA 的长度
+//      -p p        UA 中包含 str_preserve 的概率
+//      -l n        同模块参数 len_ua
+//      -L          同模块参数 stateless
+//      -C n        同模块参数 stateless_cache
+//      -R 文件     飞行记录器的记录写到这个文件，用 rkpRecord 解码
+//      -P          同模块参数 profile，最后输出所有场景合计的各个阶段的累计耗时
+//      -B          不生成数据流，而是运行 src/rkpTest.h 中的 KUnit 用例并输出耗时（与内核中的 xmurp-ua-test.ko 相同），有用例失败时返回 1
+#include "rkpLib.h"
+#include <unistd.h>
+
+struct rkpGen_config
+{
+    const char* name;
+    unsigned flows, requests;
+    unsigned seg_min, seg_max;
+    double reorder, loss, dup;
+    unsigned len_ua;                            // 请求中 UA 的长度
+    double preserve;
+    unsigned body;                              // 大于 0 时发送 POST 请求，带有这么长的 body
+    double psh_body;                            // body 中的分段带有 psh 的概率
+};
+
+static struct rkpGen_config rkpGen_scenarios[] =
+{
+//   名称          流    请求  分段大小     乱序   丢包   重复  UA   preserve body  psh
+    {"plain",      1000, 4,    1460, 1460,  0,     0,     0,    64,  0,       0,    0},
+    {"split",      1000, 4,    16,   64,    0,     0,     0,    64,  0,       0,    0},
+    {"reorder",    1000, 4,    32,   256,   0.2,   0,     0,    64,  0,       0,    0},
+    {"loss",       1000, 4,    32,   256,   0,     0.05,  0,    64,  0,       0,    0},
+    {"dup",        1000, 4,    64,   512,   0,     0,     0.1,  64,  0,       0,    0},
+    {"psh_body",   1000, 4,    512,  1460,  0,     0,     0,    64,  0,       4096, 0.3},
+    {"tiny",       200,  2,    1,    8,     0,     0,     0,    128, 0,       0,    0},
+    {"preserve",   1000, 4,    16,   64,    0,     0,     0,    64,  0.5,     0,    0},
+    {"mixed",      1000, 4,    8,    1460,  0.05,  0.02,  0.02, 96,  0.2,     1024, 0.1},
+};
+#define rkpGen_nScenario (sizeof(rkpGen_scenarios) / sizeof(rkpGen_scenarios[0]))
+
+static const char* rkpGen_preserveStr = "Firefox";
+
+// 随机数，xorshift64*
+static u64 rkpGen_state;
+u64 rkpGen_rand(void)
+{
+    rkpGen_state ^= rkpGen_state >> 12;
+    rkpGen_state ^= rkpGen_state << 25;
+    rkpGen_state ^= rkpGen_state >> 27;
+    return rkpGen_state * 0x2545F4914F6CDD1DULL;
+}
+unsigned rkpGen_range(unsigned a, unsigned b)
+{
+    return a + rkpGen_rand() % (b - a + 1);
+}
+_Bool rkpGen_chance(double p)
+{
+    return p > 0 && (rkpGen_rand() >> 11) * (1.0 / (1ULL << 53)) < p;
+}
+
+struct rkpGen_packet
+{
+    struct sk_buff skb;
+    unsigned char buff[];
+};
+static struct rkpGen_packet** rkpGen_packets;
+static unsigned rkpGen_n, rkpGen_cap;
+
+struct rkpGen_packet* rkpGen_packet(unsigned flow, _Bool fromServer, u32 seq, u32 ack, const unsigned char* data, unsigned len, _Bool psh)
+// 构造一个包并追加到 rkpGen_packets。rkpManager 不检查校验和，所以不计算
+{
+    struct rkpGen_packet* p = calloc(1, sizeof(struct rkpGen_packet) + 40 + len);
+    struct iphdr* iph = (struct iphdr*)p -> buff;
+    struct tcphdr* tcph = (struct tcphdr*)(p -> buff + 20);
+    u32 client = htonl((192 << 24) | (168 << 16) | (flow >> 14 << 8) | 2), server = htonl((10 << 24) | (flow & 0xFF));
+    u16 port = htons(1024 + (flow & 0x3FFF)), http = htons(80);
+    iph -> version = 4;
+    iph -> ihl = 5;
+    iph -> tot_len = htons(40 + len);
+    iph -> ttl = 64;
+    iph -> protocol = IPPROTO_TCP;
+    iph -> saddr = fromServer ? server : client;
+    iph -> daddr = fromServer ? client : server;
+    tcph -> source = fromServer ? http : port;
+    tcph -> dest = fromServer ? port : http;
+    tcph -> seq = htonl(seq);
+    tcph -> ack_seq = htonl(ack);
+    tcph -> doff = 5;
+    tcph -> ack = 1;
+    tcph -> psh = psh;
+    tcph -> window = htons(65535);
+    if(len != 0)
+        memcpy(p -> buff + 40, data, len);
+    p -> skb.data = p -> buff;
+    p -> skb.len = 40 + len;
+    p -> skb.truesize = ksize(p) + sizeof(struct sk_buff);
+    if(rkpGen_n == rkpGen_cap)
+    {
+        rkpGen_cap = rkpGen_cap ? rkpGen_cap * 2 : 4096;
+        rkpGen_packets = realloc(rkpGen_packets, sizeof(struct rkpGen_packet*) * rkpGen_cap);
+    }
+    rkpGen_packets[rkpGen_n++] = p;
+    return p;
+}
+
+struct rkpGen_segment
+{
+    u32 seq;
+    unsigned off, len;                          // 在请求的文本中的位置
+    _Bool psh, ack;                             // ack 为真时表示服务端确认到 seq
+    _Bool syn;                                  // 客户端的 SYN，seq 为第一个字节的序列号减一
+};
+
+unsigned rkpGen_request(const struct rkpGen_config* cfg, unsigned char* buff)
+// 生成一个请求的文本，返回长度
+{
+    unsigned len = 0, i, n_ua = cfg -> len_ua;
+    len += sprintf((char*)buff + len, "%s /%08llx HTTP/1.1\r\nHost: example.com\r\nUser-Agent: ",
+            cfg -> body ? "POST" : "GET", (unsigned long long)(rkpGen_rand() & 0xFFFFFFFF));
+    if(rkpGen_chance(cfg -> preserve) && n_ua > strlen(rkpGen_preserveStr))
+    {
+        unsigned pos = rkpGen_range(0, n_ua - strlen(rkpGen_preserveStr));
+        for(i = 0; i < n_ua; i++)
+            buff[len + i] = 'a' + rkpGen_rand() % 26;
+        memcpy(buff + len + pos, rkpGen_preserveStr, strlen(rkpGen_preserveStr));
+    }
+    else
+        for(i = 0; i < n_ua; i++)
+            buff[len + i] = 'a' + rkpGen_rand() % 26;
+    len += n_ua;
+    if(cfg -> body)
+    {
+        len += sprintf((char*)buff + len, "\r\nContent-Length: %u\r\n\r\n", cfg -> body);
+        for(i = 0; i < cfg -> body; i++)
+            buff[len + i] = 'A' + rkpGen_rand() % 26;
+        len += cfg -> body;
+    }
+    else
+        len += sprintf((char*)buff + len, "\r\nAccept: */*\r\n\r\n");
+    return len;
+}
+
+void rkpGen_build(const struct rkpGen_config* cfg)
+// 生成所有的包：先为每个流生成带有乱序、丢包、重复的分段序列，再随机地交错各个流
+{
+    unsigned f, q, i, n_total = 0;
+    unsigned char** text = malloc(sizeof(unsigned char*) * cfg -> flows);
+    struct rkpGen_segment** segs = malloc(sizeof(struct rkpGen_segment*) * cfg -> flows);
+    unsigned* n_seg = calloc(cfg -> flows, sizeof(unsigned));
+    unsigned* next = calloc(cfg -> flows, sizeof(unsigned));
+    unsigned* active = malloc(sizeof(unsigned) * cfg -> flows);
+    unsigned n_active;
+
+    for(f = 0; f < cfg -> flows; f++)
+    {
+        unsigned len = 0, cap_seg, n;
+        u32 seq0 = rkpGen_rand();
+        text[f] = malloc((cfg -> len_ua + cfg -> body + 128) * cfg -> requests);
+        cap_seg = 16;
+        segs[f] = malloc(sizeof(struct rkpGen_segment) * cap_seg);
+        // 和真实的连接一样先握手，模块（特别是打开 stateless 时）从 SYN 知道流从哪里开始
+        segs[f][0].seq = seq0 - 1;
+        segs[f][0].off = segs[f][0].len = 0;
+        segs[f][0].psh = segs[f][0].ack = 0;
+        segs[f][0].syn = 1;
+        n = 1;
+        for(q = 0; q < cfg -> requests; q++)
+        {
+            unsigned begin = len, body_begin;
+            len += rkpGen_request(cfg, text[f] + len);
+            body_begin = len - cfg -> body;
+            while(begin < len)
+            {
+                struct rkpGen_segment s;
+                s.off = begin;
+                s.len = rkpGen_range(cfg -> seg_min, cfg -> seg_max);
+                if(s.len > len - begin)
+                    s.len = len - begin;
+                s.seq = seq0 + begin;
+                s.psh = begin + s.len == len || (begin >= body_begin && cfg -> body && rkpGen_chance(cfg -> psh_body));
+                s.ack = s.syn = 0;
+                begin += s.len;
+                if(n + 2 >= cap_seg)
+                    segs[f] = realloc(segs[f], sizeof(struct rkpGen_segment) * (cap_seg *= 2));
+                segs[f][n++] = s;
+            }
+            // 服务端确认整个请求
+            segs[f][n].seq = seq0 + len;
+            segs[f][n].off = segs[f][n].len = 0;
+            segs[f][n].psh = segs[f][n].syn = 0;
+            segs[f][n].ack = 1;
+            n++;
+        }
+
+        // 乱序、丢包和重复，都只发生在客户端发出的包上
+        {
+            struct rkpGen_segment* out = malloc(sizeof(struct rkpGen_segment) * n * 3);
+            unsigned n_out = 0;
+            for(i = 0; i < n; i++)
+            {
+                struct rkpGen_segment s = segs[f][i];
+                if(s.ack || s.syn)
+                {
+                    out[n_out++] = s;
+                    continue;
+                }
+                if(rkpGen_chance(cfg -> loss))
+                {
+                    // 丢掉这个包，几个包之后重传
+                    unsigned delay = rkpGen_range(1, 8), j;
+                    for(j = i + 1; j < n && j <= i + delay && !segs[f][j].ack; j++)
+                        out[n_out++] = segs[f][j];
+                    out[n_out++] = s;
+                    i = j - 1;
+                    continue;
+                }
+                if(i + 1 < n && !segs[f][i + 1].ack && rkpGen_chance(cfg -> reorder))
+                {
+                    out[n_out++] = segs[f][i + 1];
+                    out[n_out++] = s;
+                    i++;
+                    continue;
+                }
+                out[n_out++] = s;
+                if(rkpGen_chance(cfg -> dup))
+                    out[n_out++] = s;
+            }
+            free(segs[f]);
+            segs[f] = out;
+            n_seg[f] = n_out;
+            n_total += n_out;
+        }
+    }
+
+    n_active = cfg -> flows;
+    for(f = 0; f < cfg -> flows; f++)
+        active[f] = f;
+    for(i = 0; i < n_total; i++)
+    {
+        unsigned k = rkpGen_rand() % n_active, ff = active[k];
+        const struct rkpGen_segment* s = &segs[ff][next[ff]++];
+        if(s -> ack)
+            rkpGen_packet(ff, 1, 1, s -> seq, 0, 0, 0);
+        else if(s -> syn)
+        {
+            struct tcphdr* tcph = (struct tcphdr*)(rkpGen_packet(ff, 0, s -> seq, 0, 0, 0, 0) -> buff + 20);
+            tcph -> syn = 1;
+            tcph -> ack = 0;
+        }
+        else
+            rkpGen_packet(ff, 0, s -> seq, 1, text[ff] + s -> off, s -> len, s -> psh);
+        if(next[ff] == n_seg[ff])
+            active[k] = active[--n_active];
+    }
+
+    for(f = 0; f < cfg -> flows; f++)
+    {
+        free(text[f]);
+        free(segs[f]);
+    }
+    free(text);
+    free(segs);
+    free(n_seg);
+    free(next);
+    free(active);
+}
+
+static void rkpGen_ignore(struct sk_buff* skb) {}
+
+static int rkpGen_cmp(const void* a, const void* b)
+{
+    u64 x = *(const u64*)a, y = *(const u64*)b;
+    return x < y ? -1 : x > y;
+}
+
+void rkpGen_run(const struct rkpGen_config* cfg)
+{
+    struct rkpManager* rkpm;
+    struct rkpLib_stat st0, st;
+    u64* ns;
+    u64 total = 0;
+    long peak_held = 0, peak_mem = 0, peak_flows = 0;
+    unsigned i;
+    unsigned long expected = (unsigned long)cfg -> flows * cfg -> requests;
+
+    rkpGen_n = 0;
+    rkpGen_build(cfg);
+    ns = malloc(sizeof(u64) * (rkpGen_n + 1));
+    rkpm = rkpLib_manager_new();
+    rkpLib_stat(rkpm, &st0);
+    for(i = 0; i < rkpGen_n; i++)
+    {
+        u64 t = ktime_get_ns();
+        rkpLib_execute(rkpm, &rkpGen_packets[i] -> skb);
+        ns[i] = ktime_get_ns() - t;
+        total += ns[i];
+        rkpLib_stat(rkpm, &st);
+        if(st.packets_held - st0.packets_held > peak_held)
+            peak_held = st.packets_held - st0.packets_held;
+        if(st.mem_used - st0.mem_used > peak_mem)
+            peak_mem = st.mem_used - st0.mem_used;
+        if(st.flows - st0.flows > peak_flows)
+            peak_flows = st.flows - st0.flows;
+    }
+    rkpLib_manager_delete(rkpm);
+    qsort(ns, rkpGen_n, sizeof(u64), rkpGen_cmp);
+
+    printf("%-10s %8u %8.3f %8.1f %8llu %8llu %8llu %8lu %8lu %8lu %8lu %8lu %6ld %8ld %6ld %8lu\n", cfg -> name, rkpGen_n,
+            total ? rkpGen_n * 1e3 / total : 0, rkpGen_n ? (double)total / rkpGen_n : 0,
+            (unsigned long long)ns[rkpGen_n / 2], (unsigned long long)ns[rkpGen_n * 99 / 100], (unsigned long long)ns[rkpGen_n - 1],
+            expected, st.ua_rewritten - st0.ua_rewritten, st.ua_preserved - st0.ua_preserved,
+            st.disordered - st0.disordered, st.lenUa_overflow - st0.lenUa_overflow, peak_held, peak_mem, peak_flows,
+            st.stateless_evicted - st0.stateless_evicted);
+
+    for(i = 0; i < rkpGen_n; i++)
+        free(rkpGen_packets[i]);
+    free(ns);
+}
+
+int main(int argc, char** argv)
+{
+    struct rkpLib_config lib;
+    struct rkpGen_config over;
+    const char* preserve[1] = {rkpGen_preserveStr};
+    unsigned i, j;
+    u64 seed = 1;
+    int opt;
+    _Bool bench = 0;
+    // 命令行中指定的参数覆盖所有场景的默认值，没有指定的用 -1 表示
+    memset(&over, 0xFF, sizeof(over));
+    over.reorder = over.loss = over.dup = over.preserve = -1;
+
+    rkpLib_defaultConfig(&lib);
+    while((opt = getopt(argc, argv, "S:f:q:z:o:x:d:u:p:l:LC:R:PB")) != -1)
+        switch(opt)
+        {
+        case 'S':
+            seed = strtoull(optarg, 0, 0);
+            break;
+        case 'f':
+            over.flows = strtoul(optarg, 0, 0);
+            break;
+        case 'q':
+            over.requests = strtoul(optarg, 0, 0);
+            break;
+        case 'z':
+            if(sscanf(optarg, "%u,%u", &over.seg_min, &over.seg_max) != 2 || over.seg_min == 0 || over.seg_min > over.seg_max)
+            {
+                fprintf(stderr, "bad segment size range: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            over.reorder = strtod(optarg, 0);
+            break;
+        case 'x':
+            over.loss = strtod(optarg, 0);
+            break;
+        case 'd':
+            over.dup = strtod(optarg, 0);
+            break;
+        case 'u':
+            over.len_ua = strtoul(optarg, 0, 0);
+            break;
+        case 'p':
+            over.preserve = strtod(optarg, 0);
+            break;
+        case 'l':
+            lib.len_ua = strtoul(optarg, 0, 0);
+            break;
+        case 'L':
+            lib.stateless = 1;
+            break;
+        case 'C':
+            lib.stateless_cache = strtoul(optarg, 0, 0);
+            break;
+        case 'R':
+            lib.record = optarg;
+            break;
+        case 'P':
+            lib.profile = 1;
+            break;
+        case 'B':
+            bench = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-S seed] [-f flows] [-q requests] [-z min,max] [-o reorder] [-x loss] [-d dup] [-u ua_len]"
+                    " [-p preserve] [-l len_ua] [-L] [-C stateless_cache] [-R record] [-P] [-B] [scenario]...\n", argv[0]);
+            return 1;
+        }
+    lib.str_preserve = preserve;
+    lib.n_str_preserve = 1;
+    lib.mem_budget = 0;
+    if(rkpLib_init(&lib) != 0)
+        return 1;
+    rkpLib_xmit = rkpGen_ignore;
+    rkpLib_free = rkpGen_ignore;
+    if(bench)
+    {
+        int n_failed = rkpLib_test(stdout);
+        rkpLib_exit();
+        return n_failed != 0;
+    }
+
+    printf("%-10s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s %6s %8s %6s %8s\n", "scenario", "packets", "Mpps", "avg_ns",
+            "p50_ns", "p99_ns", "max_ns", "requests", "rewrite", "preserve", "disorder", "overflow", "held", "mem", "flows", "evicted");
+    for(i = 0; i < rkpGen_nScenario; i++)
+    {
+        struct rkpGen_config cfg = rkpGen_scenarios[i];
+        if(optind < argc)
+        {
+            for(j = optind; j < argc; j++)
+                if(strcmp(argv[j], cfg.name) == 0)
+                    break;
+            if(j == argc)
+                continue;
+        }
+        if(over.flows != (unsigned)-1) cfg.flows = over.flows;
+        if(over.requests != (unsigned)-1) cfg.requests = over.requests;
+        if(over.seg_min != (unsigned)-1) cfg.seg_min = over.seg_min, cfg.seg_max = over.seg_max;
+        if(over.reorder >= 0) cfg.reorder = over.reorder;
+        if(over.loss >= 0) cfg.loss = over.loss;
+        if(over.dup >= 0) cfg.dup = over.dup;
+        if(over.len_ua != (unsigned)-1) cfg.len_ua = over.len_ua;
+        if(over.preserve >= 0) cfg.preserve = over.preserve;
+        // 每个场景都从同一个种子开始，单独运行一个场景时结果也相同
+        rkpGen_state = seed * 0x9E3779B97F4A7C15ULL + i + 1;
+        rkpGen_run(&cfg);
+    }
+    if(lib.profile)
+        rkpLib_profile(stdout);
+    rkpLib_exit();
+    return 0;
+}
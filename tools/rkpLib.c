@@ -0,0 +1,203 @@
+// 将 src 下的头文件原样编译为用户态的库，供 tools 下的各个程序使用
+#include "../src/common.h"
+#include "../src/rkpTest.h"
+#include "rkpLib.h"
+
+unsigned long rkpShim_jiffies = 0;
+u64 rkpShim_clock = 0;
+void (*rkpShim_xmit)(struct sk_buff*) = 0;
+void (*rkpShim_free)(struct sk_buff*) = 0;
+int rkpShim_cpu(void)
+{
+    static int n = 0;
+    static __thread int cpu = -1;
+    if(cpu < 0)
+        cpu = __atomic_fetch_add(&n, 1, __ATOMIC_RELAXED) % rkpShim_nCpu;
+    return cpu;
+}
+
+static void rkpLib_xmit_default(struct sk_buff* skb) {}
+void (*rkpLib_xmit)(struct sk_buff*) = rkpLib_xmit_default;
+void (*rkpLib_free)(struct sk_buff*) = rkpLib_xmit_default;
+
+static void __rkpLib_xmit(struct sk_buff* skb)
+{
+    rkpLib_xmit(skb);
+}
+static void __rkpLib_free(struct sk_buff* skb)
+{
+    rkpLib_free(skb);
+}
+
+void rkpLib_defaultConfig(struct rkpLib_config* cfg)
+{
+    memset(cfg, 0, sizeof(struct rkpLib_config));
+    cfg -> autocapture = true;
+    cfg -> mark_capture = 0x100;
+    cfg -> mark_ack = 0x200;
+    cfg -> time_keepalive = 1200;
+    cfg -> len_ua = 2;
+    cfg -> mem_budget = 4096;
+    cfg -> time_hold = 200;
+    cfg -> stateless_cache = 4096;
+}
+
+int rkpLib_init(const struct rkpLib_config* cfg)
+{
+    unsigned i;
+    int ret;
+    if(cfg -> n_str_preserve > sizeof(str_preserve) / sizeof(str_preserve[0])
+            || cfg -> n_str_rule > sizeof(str_rule) / sizeof(str_rule[0]))
+        return -EINVAL;
+    autocapture = cfg -> autocapture;
+    mark_capture = cfg -> mark_capture;
+    mark_ack = cfg -> mark_ack;
+    time_keepalive = cfg -> time_keepalive;
+    len_ua = cfg -> len_ua;
+    mem_budget = cfg -> mem_budget;
+    time_hold = cfg -> time_hold;
+    stateless = cfg -> stateless;
+    stateless_cache = cfg -> stateless_cache;
+    n_str_preserve = cfg -> n_str_preserve;
+    for(i = 0; i < n_str_preserve; i++)
+        str_preserve[i] = (char*)cfg -> str_preserve[i];
+    n_str_rule = cfg -> n_str_rule;
+    for(i = 0; i < n_str_rule; i++)
+        str_rule[i] = (char*)cfg -> str_rule[i];
+    if(cfg -> record != 0)
+    {
+        static struct rchan chan;
+        chan.fp = fopen(cfg -> record, "wb");
+        if(chan.fp == 0)
+            return -errno;
+        rkpRecord_chan = &chan;
+        static_branch_enable(&rkpSetting_record);
+    }
+    rkpStat_stage_init();
+    if(cfg -> profile)
+        static_branch_enable(&rkpSetting_profile);
+    else
+        static_branch_disable(&rkpSetting_profile);
+
+    memcpy(str_uaRkp, "RKP/", 4);
+    memcpy(str_uaRkp + 4, "99", 2);
+    memcpy(str_uaRkp + 6, ".0", 3);
+    ret = rkpRule_init();
+    if(ret != 0)
+        return ret;
+    ret = rkpCache_init();
+    if(ret != 0)
+    {
+        rkpRule_exit();
+        return ret;
+    }
+
+    rkpShim_xmit = __rkpLib_xmit;
+    rkpShim_free = __rkpLib_free;
+    return rkpMem_init();
+}
+void rkpLib_exit(void)
+{
+    if(rkpRecord_chan != 0)
+    {
+        static_branch_disable(&rkpSetting_record);
+        fclose(rkpRecord_chan -> fp);
+        rkpRecord_chan = 0;
+    }
+    rkpMem_exit();
+    rkpCache_exit();
+    rkpRule_exit();
+}
+
+struct rkpManager* rkpLib_manager_new(void)
+{
+    return rkpManager_new();
+}
+void rkpLib_manager_delete(struct rkpManager* rkpm)
+{
+    rkpManager_delete(rkpm);
+}
+
+unsigned rkpLib_execute(struct rkpManager* rkpm, struct sk_buff* skb)
+{
+    unsigned rtn;
+    u_int64_t t;
+    bool capture;
+    rkpStat_inc_in(rkpm -> stat, packet_seen);
+    t = rkpStat_stage_begin();
+    capture = rkpSetting_capture(skb);
+    rkpStat_stage_end(rkpStat_stage_capture, t);
+    if(!capture)
+        return NF_ACCEPT;
+    rkpStat_inc_in(rkpm -> stat, packet_captured);
+    rtn = rkpManager_execute(rkpm, skb);
+    if(rtn == NF_ACCEPT)
+        rkpStat_inc_in(rkpm -> stat, verdict_accept);
+    else if(rtn == NF_STOLEN)
+        rkpStat_inc_in(rkpm -> stat, verdict_stolen);
+    else if(rtn == NF_DROP)
+        rkpStat_inc_in(rkpm -> stat, verdict_drop);
+    return rtn;
+}
+
+void rkpLib_advance(unsigned long ms)
+{
+    rkpShim_jiffies += ms * HZ / 1000;
+}
+void rkpLib_clock(void)
+{
+    __atomic_store_n(&rkpShim_jiffies, (unsigned long)(ktime_get_ns() / (1000000000 / HZ)), __ATOMIC_RELAXED);
+}
+void rkpLib_setClock(u64 ns)
+{
+    rkpShim_clock = ns != 0 ? ns : 1;
+    rkpShim_jiffies = (unsigned long)(ns / (1000000000 / HZ));
+}
+void rkpLib_refresh(struct rkpManager* rkpm)
+{
+    struct hrtimer* timer = __rkpManager_hold_timer(rkpm);
+    if((long)(jiffies - rkpm -> timer.expires) >= 0)
+        __rkpManager_refresh(&rkpm -> timer);
+    if(timer -> queued && (ktime_t)ktime_get_ns() >= timer -> expires)
+    {
+        timer -> queued = 0;
+        timer -> function(timer);
+    }
+}
+
+void rkpLib_stat(struct rkpManager* rkpm, struct rkpLib_stat* out)
+{
+    struct rkpStat rkpst, rkpst2;
+    unsigned i;
+    static_assert(offsetof(struct rkpLib_stat, mem_used) == sizeof(struct rkpStat), "rkpLib_stat does not match rkpStat.");
+    rkpStat_sum(0, &rkpst);
+    if(rkpm != 0)
+    {
+        rkpStat_sum(rkpm -> stat, &rkpst2);
+        for(i = 0; i < sizeof(struct rkpStat) / sizeof(unsigned long); i++)
+            ((unsigned long*)&rkpst)[i] += ((const unsigned long*)&rkpst2)[i];
+    }
+    memcpy(out, &rkpst, sizeof(struct rkpStat));
+    out -> mem_used = percpu_counter_sum(&rkpMem_used);
+}
+
+int rkpLib_test(FILE* fp)
+{
+    struct kunit_case* c;
+    int n_failed = 0;
+    // 规则和内存计数已经由 rkpLib_init 初始化好了，不调用 rkpTest_init
+    for(c = rkpTest_suite.test_cases; c -> run_case != 0; c++)
+    {
+        struct kunit test = {c -> name, false, fp};
+        c -> run_case(&test);
+        fprintf(fp, "%s %s\n", test.failed ? "not ok" : "ok", c -> name);
+        n_failed += test.failed;
+    }
+    return n_failed;
+}
+
+void rkpLib_profile(FILE* fp)
+{
+    struct seq_file m = {fp};
+    rkpStat_stage_show(&m);
+}
@@ -0,0 +1,64 @@
+// 在用户态使用 rkpStream 等的接口，实现在 rkpLib.c，编译为 librkp.a。
+// 使用者不需要包含 src 下的头文件，只需要包含这个文件，自己构造 sk_buff（data 指向 IP 头）交给 rkpLib_execute。
+// 返回 NF_STOLEN 的包之后会通过 rkpLib_xmit 或者 rkpLib_free 交还给使用者。
+#pragma once
+#include "shim/rkpShim.h"
+
+struct rkpManager;
+
+struct rkpLib_config
+// 对应内核模块的参数，含义见 doc/useage.md
+{
+    _Bool autocapture;
+    unsigned mark_capture, mark_ack;
+    unsigned time_keepalive, len_ua, mem_budget, time_hold;
+    _Bool stateless;
+    unsigned stateless_cache;
+    const char* const* str_preserve;
+    unsigned n_str_preserve;
+    const char* const* str_rule;
+    unsigned n_str_rule;
+    _Bool profile;
+    const char* record;                         // 不为 0 时，飞行记录器的记录写到这个文件，用 tools/rkpRecord 解码
+};
+
+struct rkpLib_stat
+// 对应 /proc/net/xmurp-ua 中的计数
+{
+    unsigned long packet_seen, packet_captured;
+    unsigned long verdict_accept, verdict_stolen, verdict_drop;
+    unsigned long ua_rewritten, ua_preserved;
+    unsigned long rule_rewritten, rule_preserved;
+    unsigned long disordered, retransmit;
+    unsigned long lenUa_overflow, malloc_failed;
+    unsigned long budget_bypass, budget_flush;
+    unsigned long shrink_evicted, shrink_flushed;
+    unsigned long hold_expired;
+    unsigned long stateless_handled, stateless_promoted, stateless_demoted, stateless_evicted;
+    long flows, packets_held, bytes_held;
+    long mem_used;
+};
+
+void rkpLib_defaultConfig(struct rkpLib_config*);   // 填入与内核模块相同的默认值
+int rkpLib_init(const struct rkpLib_config*);       // 设置参数，成功返回 0。只能在创建 rkpManager 之前调用
+void rkpLib_exit(void);
+
+struct rkpManager* rkpLib_manager_new(void);
+void rkpLib_manager_delete(struct rkpManager*);     // 仍然截留的包会通过 rkpLib_free 交还
+unsigned rkpLib_execute(struct rkpManager*, struct sk_buff*);
+        // 与内核模块的钩子函数相同：判断是否需要处理，然后交给 rkpManager。返回 NF_ACCEPT、NF_STOLEN 或 NF_DROP
+void rkpLib_advance(unsigned long);                 // 将 jiffies 向前推进指定的毫秒数
+void rkpLib_clock(void);                            // 将 jiffies 设为单调时钟的毫秒数。处理实时的包时使用，代替 rkpLib_advance，可以在多个线程中调用
+void rkpLib_setClock(u64);
+        // 将 ktime_get_ns 和 jiffies 都设为指定的纳秒数，之后时间只由它决定。回放抓包时使用，代替 rkpLib_advance 和 rkpLib_clock
+void rkpLib_refresh(struct rkpManager*);
+        // 定时器不会自己触发，由使用者定期调用：到了时间的话，和内核中的定时器一样清理长时间不活动的流、放出截留超过 time_hold 的包
+
+void rkpLib_stat(struct rkpManager*, struct rkpLib_stat*);
+        // 取得指定的 rkpManager 的计数，加上当前线程中不属于任何 rkpManager 的计数（包括已经删除的 rkpManager 留下的）。
+        // 第一个参数为 0 时只取后者
+int rkpLib_test(FILE*);                             // 运行 src/rkpTest.h 中的 KUnit 用例，和内核中的 xmurp-ua-test.ko 相同，返回失败的用例数
+void rkpLib_profile(FILE*);                         // 输出各个阶段的累计耗时，和内核中 debugfs 的 xmurp-ua/profile 相同，只包括当前线程
+
+extern void (*rkpLib_xmit)(struct sk_buff*);        // 截留的包被放行时调用
+extern void (*rkpLib_free)(struct sk_buff*);        // 截留的包被丢弃时调用
@@ -0,0 +1,396 @@
+// 用户态的 xmurp-ua：通过 NFQUEUE 从内核取得数据包，交给 rkpManager 处理后再交还给内核，用于不能加载内核模块的场合。
+// 用法：rkpNfq [选项]
+//      -q n        使用的第一个队列的编号，默认为 0
+//      -n n        队列的个数，每个队列一个线程，默认为 1
+//      -c n        第一个线程绑定到的 CPU，之后的线程依次绑定到下一个 CPU，为 -1 时不绑定，默认为 0
+//      -w n        每处理多少个包最多发送一次批量的裁决，默认为 64
+//      -m          不使用 autocapture，而是使用包原本的 mark，需要在 NFQUEUE 之前用 iptables 打上 mark_capture 和 mark_ack
+//      -s 字符串   同模块参数 str_preserve，可以指定多次
+//      -H 规则     同模块参数 str_rule，可以指定多次
+//      -l n        同模块参数 len_ua
+//      -b n        同模块参数 mem_budget
+//      -t n        同模块参数 time_hold
+//      -L          同模块参数 stateless
+//      -R 文件     飞行记录器的记录写到这个文件，用 rkpRecord 解码
+// iptables 的规则（以 4 个队列为例，与模块的 autocapture 一样只关心 80 端口）：
+//      iptables -t mangle -A FORWARD -p tcp --dport 80 -j NFQUEUE --queue-balance 0:3 --queue-bypass
+//      iptables -t mangle -A FORWARD -p tcp --sport 80 -j NFQUEUE --queue-balance 0:3 --queue-bypass
+// --queue-balance 按源地址和目的地址的对称的哈希选择队列，一个流两个方向的包总是进入同一个队列，
+// 所以每个队列的线程使用自己的 rkpManager，线程之间不共享任何状态（只有内存的使用量是共同计算的）。
+// 不要使用 --queue-cpu-fanout，它按 CPU 选择队列，一个流的包会进入不同的队列。
+// 收到 SIGINT 或 SIGTERM 时放行仍然截留的包，输出统计后退出。
+#define _GNU_SOURCE
+#include "rkpLib.h"
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <libnetfilter_queue/libnetfilter_queue.h>
+
+struct rkpNfq_worker
+// 一个队列和处理它的线程
+{
+    unsigned queue;
+    int cpu;
+    struct nfq_handle* h;
+    struct nfq_q_handle* qh;
+    struct rkpManager* rkpm;
+    pthread_t thread;
+    struct list_head held;                      // 截留的包，按 id 从小到大排列
+    u32* batch;                                 // 没有修改、等待批量放行的包的 id，从小到大排列
+    unsigned n_batch;
+    _Bool exiting;                              // 正在退出，rkpManager 丢弃的包也放行
+    unsigned long n_packet, n_modified, n_stolen, n_drop, n_verdict, n_verdict_batch, n_enobufs;
+    struct rkpLib_stat stat;
+};
+
+struct rkpNfq_packet
+// 一个包。skb 的 data 指向 data，是收到的内容的拷贝
+{
+    u32 id;
+    struct rkpNfq_worker* w;
+    struct list_head list;
+    struct sk_buff skb;
+    unsigned char data[];
+};
+
+static struct rkpLib_config rkpNfq_cfg;
+static unsigned rkpNfq_window = 64;
+static volatile sig_atomic_t rkpNfq_stop = 0;
+
+static void rkpNfq_signal(int sig)
+{
+    rkpNfq_stop = 1;
+}
+
+static void rkpNfq_flush(struct rkpNfq_worker* w)
+// 发出等待批量放行的包的裁决。批量的裁决作用于队列中所有 id 不大于它的包，截留的包也会被放行，
+// 所以只对比最早截留的包小的部分使用批量的裁决，其余的逐个发出
+{
+    unsigned i = 0;
+    u32 held_min = list_empty(&w -> held) ? (u32)-1 : list_first_entry(&w -> held, struct rkpNfq_packet, list) -> id;
+    if(w -> n_batch == 0)
+        return;
+    while(i < w -> n_batch && w -> batch[i] < held_min)
+        i++;
+    if(i > 0)
+    {
+        nfq_set_verdict_batch(w -> qh, w -> batch[i - 1], NF_ACCEPT);
+        w -> n_verdict_batch++;
+    }
+    for(; i < w -> n_batch; i++)
+    {
+        nfq_set_verdict(w -> qh, w -> batch[i], NF_ACCEPT, 0, 0);
+        w -> n_verdict++;
+    }
+    w -> n_batch = 0;
+}
+
+static void rkpNfq_verdict(struct rkpNfq_worker* w, u32 id, unsigned verdict, const struct sk_buff* skb)
+// 立即发出一个裁决，skb 不为 0 时用它的内容替换包的内容。先发出之前的裁决，保持包的顺序
+{
+    rkpNfq_flush(w);
+    nfq_set_verdict(w -> qh, id, verdict, skb ? skb -> len : 0, skb ? skb -> data : 0);
+    w -> n_verdict++;
+}
+
+static void rkpNfq_accept(struct rkpNfq_worker* w, u32 id)
+{
+    if(w -> n_batch == rkpNfq_window)
+        rkpNfq_flush(w);
+    w -> batch[w -> n_batch++] = id;
+}
+
+// 截留的包被 rkpManager 放行或者丢弃，这时它只会在处理同一个队列的线程中（或者退出时在主线程中）
+static void rkpNfq_xmit(struct sk_buff* skb)
+{
+    struct rkpNfq_packet* p = skb -> priv;
+    list_del(&p -> list);
+    rkpNfq_verdict(p -> w, p -> id, NF_ACCEPT, skb);
+    free(p);
+}
+static void rkpNfq_free(struct sk_buff* skb)
+{
+    struct rkpNfq_packet* p = skb -> priv;
+    list_del(&p -> list);
+    if(p -> w -> exiting)
+        rkpNfq_verdict(p -> w, p -> id, NF_ACCEPT, skb);
+    else
+    {
+        rkpNfq_verdict(p -> w, p -> id, NF_DROP, 0);
+        p -> w -> n_drop++;
+    }
+    free(p);
+}
+
+static int rkpNfq_callback(struct nfq_q_handle* qh, struct nfgenmsg* nfmsg, struct nfq_data* nfa, void* data)
+{
+    struct rkpNfq_worker* w = data;
+    struct nfqnl_msg_packet_hdr* ph = nfq_get_msg_packet_hdr(nfa);
+    struct rkpNfq_packet* p;
+    unsigned char* payload;
+    int len;
+    unsigned rtn;
+    u32 id;
+
+    if(ph == 0)
+        return 0;
+    id = ntohl(ph -> packet_id);
+    w -> n_packet++;
+    len = nfq_get_payload(nfa, &payload);
+    if(len < (int)sizeof(struct iphdr) || (payload[0] >> 4) != 4 || (p = malloc(sizeof(struct rkpNfq_packet) + len)) == 0)
+    {
+        rkpNfq_accept(w, id);
+        return 0;
+    }
+    p -> id = id;
+    p -> w = w;
+    memcpy(p -> data, payload, len);
+    memset(&p -> skb, 0, sizeof(struct sk_buff));
+    p -> skb.data = p -> data;
+    p -> skb.len = len;
+    p -> skb.truesize = sizeof(struct rkpNfq_packet) + len;
+    p -> skb.mark = nfq_get_nfmark(nfa);
+    p -> skb.priv = p;
+
+    rtn = rkpLib_execute(w -> rkpm, &p -> skb);
+    if(rtn == NF_STOLEN)
+    {
+        // id 是递增的，加到末尾就能保持顺序
+        list_add_tail(&p -> list, &w -> held);
+        w -> n_stolen++;
+        return 0;
+    }
+    if(rtn == NF_DROP)
+    {
+        rkpNfq_verdict(w, id, NF_DROP, 0);
+        w -> n_drop++;
+    }
+    else if(memcmp(p -> data, payload, len) != 0)
+    {
+        rkpNfq_verdict(w, id, NF_ACCEPT, &p -> skb);
+        w -> n_modified++;
+    }
+    else
+        rkpNfq_accept(w, id);
+    free(p);
+    return 0;
+}
+
+static int rkpNfq_open(struct rkpNfq_worker* w)
+{
+    int one = 1;
+    w -> h = nfq_open();
+    if(w -> h == 0)
+    {
+        perror("nfq_open");
+        return -1;
+    }
+    // 新的内核不需要这两步，旧的内核需要
+    nfq_unbind_pf(w -> h, AF_INET);
+    nfq_bind_pf(w -> h, AF_INET);
+    w -> qh = nfq_create_queue(w -> h, w -> queue, rkpNfq_callback, w);
+    if(w -> qh == 0)
+    {
+        fprintf(stderr, "nfq_create_queue %u failed.\n", w -> queue);
+        return -1;
+    }
+    if(nfq_set_mode(w -> qh, NFQNL_COPY_PACKET, 0xFFFF) < 0)
+    {
+        fprintf(stderr, "nfq_set_mode %u failed.\n", w -> queue);
+        return -1;
+    }
+    // 处理不过来时让内核直接放行，而不是丢包
+    nfq_set_queue_maxlen(w -> qh, 4096);
+    nfq_set_queue_flags(w -> qh, NFQA_CFG_F_FAIL_OPEN, NFQA_CFG_F_FAIL_OPEN);
+    nfnl_rcvbufsiz(nfq_nfnlh(w -> h), 8 << 20);
+    setsockopt(nfq_fd(w -> h), SOL_NETLINK, NETLINK_NO_ENOBUFS, &one, sizeof(one));
+    return 0;
+}
+
+static void* rkpNfq_run(void* param)
+{
+    struct rkpNfq_worker* w = param;
+    int fd = nfq_fd(w -> h);
+    char* buf = malloc(0x10000 + 4096);
+    if(w -> cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w -> cpu, &set);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            fprintf(stderr, "queue %u: can not bind to cpu %d.\n", w -> queue, w -> cpu);
+    }
+    while(!rkpNfq_stop)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        unsigned i;
+        // 同一批的包使用同一个时间
+        rkpLib_clock();
+        rkpLib_refresh(w -> rkpm);
+        // 超时不能太长，否则截留的包要多等这么久才会因为 time_hold 放出
+        if(poll(&pfd, 1, 20) <= 0)
+            continue;
+        for(i = 0; i < rkpNfq_window; i++)
+        {
+            int len = recv(fd, buf, 0x10000 + 4096, MSG_DONTWAIT);
+            if(len < 0)
+            {
+                if(errno == ENOBUFS)
+                {
+                    w -> n_enobufs++;
+                    continue;
+                }
+                break;
+            }
+            nfq_handle_packet(w -> h, buf, len);
+        }
+        rkpNfq_flush(w);
+    }
+    // 计数是每个线程一份的，在退出前取出来
+    rkpLib_stat(w -> rkpm, &w -> stat);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* preserve[128];
+    const char* rule[15];
+    unsigned n_preserve = 0, n_rule = 0, queue = 0, n = 1, i;
+    int cpu = 0, opt;
+    struct rkpNfq_worker* workers;
+    struct rkpLib_stat sum;
+
+    rkpLib_defaultConfig(&rkpNfq_cfg);
+    while((opt = getopt(argc, argv, "q:n:c:w:ms:H:l:b:t:LR:")) != -1)
+        switch(opt)
+        {
+        case 'q':
+            queue = strtoul(optarg, 0, 0);
+            break;
+        case 'n':
+            n = strtoul(optarg, 0, 0);
+            break;
+        case 'c':
+            cpu = strtol(optarg, 0, 0);
+            break;
+        case 'w':
+            rkpNfq_window = strtoul(optarg, 0, 0);
+            break;
+        case 'm':
+            rkpNfq_cfg.autocapture = false;
+            break;
+        case 's':
+            if(n_preserve < 128)
+                preserve[n_preserve++] = optarg;
+            break;
+        case 'H':
+            if(n_rule < 15)
+                rule[n_rule++] = optarg;
+            break;
+        case 'l':
+            rkpNfq_cfg.len_ua = strtoul(optarg, 0, 0);
+            break;
+        case 'b':
+            rkpNfq_cfg.mem_budget = strtoul(optarg, 0, 0);
+            break;
+        case 't':
+            rkpNfq_cfg.time_hold = strtoul(optarg, 0, 0);
+            break;
+        case 'L':
+            rkpNfq_cfg.stateless = true;
+            break;
+        case 'R':
+            rkpNfq_cfg.record = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-q first_queue] [-n queues] [-c first_cpu] [-w window] [-m] [-s preserve]... [-H rule]... [-l len_ua] [-b mem_budget] [-t time_hold] [-L] [-R record]\n", argv[0]);
+            return 1;
+        }
+    if(n == 0 || rkpNfq_window == 0)
+    {
+        fprintf(stderr, "-n and -w must be positive.\n");
+        return 1;
+    }
+    rkpNfq_cfg.str_preserve = preserve;
+    rkpNfq_cfg.n_str_preserve = n_preserve;
+    rkpNfq_cfg.str_rule = rule;
+    rkpNfq_cfg.n_str_rule = n_rule;
+    if(rkpLib_init(&rkpNfq_cfg) != 0)
+        return 1;
+    rkpLib_xmit = rkpNfq_xmit;
+    rkpLib_free = rkpNfq_free;
+    rkpLib_clock();
+
+    // rkpManager 只能在一个线程中创建和删除，所以都在主线程中做
+    workers = calloc(n, sizeof(struct rkpNfq_worker));
+    for(i = 0; i < n; i++)
+    {
+        struct rkpNfq_worker* w = &workers[i];
+        w -> queue = queue + i;
+        w -> cpu = cpu < 0 ? -1 : cpu + (int)i;
+        INIT_LIST_HEAD(&w -> held);
+        w -> batch = malloc(sizeof(u32) * rkpNfq_window);
+        w -> rkpm = rkpLib_manager_new();
+        if(w -> batch == 0 || w -> rkpm == 0 || rkpNfq_open(w) != 0)
+            return 1;
+    }
+    signal(SIGINT, rkpNfq_signal);
+    signal(SIGTERM, rkpNfq_signal);
+    for(i = 0; i < n; i++)
+        if(pthread_create(&workers[i].thread, 0, rkpNfq_run, &workers[i]) != 0)
+        {
+            fprintf(stderr, "pthread_create failed.\n");
+            return 1;
+        }
+
+    memset(&sum, 0, sizeof(sum));
+    for(i = 0; i < n; i++)
+    {
+        struct rkpNfq_worker* w = &workers[i];
+        pthread_join(w -> thread, 0);
+        w -> exiting = true;
+        rkpLib_manager_delete(w -> rkpm);
+        rkpNfq_flush(w);
+        nfq_destroy_queue(w -> qh);
+        nfq_close(w -> h);
+        printf("queue %u: packets %lu modified %lu stolen %lu drop %lu verdict %lu verdict_batch %lu enobufs %lu\n",
+                w -> queue, w -> n_packet, w -> n_modified, w -> n_stolen, w -> n_drop, w -> n_verdict, w -> n_verdict_batch, w -> n_enobufs);
+        sum.packet_captured += w -> stat.packet_captured;
+        sum.ua_rewritten += w -> stat.ua_rewritten;
+        sum.ua_preserved += w -> stat.ua_preserved;
+        sum.rule_rewritten += w -> stat.rule_rewritten;
+        sum.rule_preserved += w -> stat.rule_preserved;
+        sum.disordered += w -> stat.disordered;
+        sum.retransmit += w -> stat.retransmit;
+        sum.lenUa_overflow += w -> stat.lenUa_overflow;
+        sum.budget_bypass += w -> stat.budget_bypass;
+        sum.hold_expired += w -> stat.hold_expired;
+        sum.stateless_handled += w -> stat.stateless_handled;
+        sum.stateless_promoted += w -> stat.stateless_promoted;
+        sum.stateless_demoted += w -> stat.stateless_demoted;
+        sum.stateless_evicted += w -> stat.stateless_evicted;
+        free(w -> batch);
+    }
+    printf("packet_captured: %lu\n", sum.packet_captured);
+    printf("ua_rewritten: %lu\n", sum.ua_rewritten);
+    printf("ua_preserved: %lu\n", sum.ua_preserved);
+    printf("rule_rewritten: %lu\n", sum.rule_rewritten);
+    printf("rule_preserved: %lu\n", sum.rule_preserved);
+    printf("disordered: %lu\n", sum.disordered);
+    printf("retransmit: %lu\n", sum.retransmit);
+    printf("lenUa_overflow: %lu\n", sum.lenUa_overflow);
+    printf("budget_bypass: %lu\n", sum.budget_bypass);
+    printf("hold_expired: %lu\n", sum.hold_expired);
+    printf("stateless_handled: %lu\n", sum.stateless_handled);
+    printf("stateless_promoted: %lu\n", sum.stateless_promoted);
+    printf("stateless_demoted: %lu\n", sum.stateless_demoted);
+    printf("stateless_evicted: %lu\n", sum.stateless_evicted);
+    free(workers);
+    rkpLib_exit();
+    return 0;
+}
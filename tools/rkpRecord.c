@@ -0,0 +1,217 @@
+// 解码飞行记录器的记录（见 src/rkpRecord.h），按流整理成时间线输出。
+// 用法：rkpRecord [选项] 文件...
+//      -f 哈希     只输出这个流（十六进制，与输出中 flow 后面的相同）
+//      -a 地址     只输出客户端或服务端是这个 IPv4 地址的流
+// 文件可以是内核的 debugfs 中的 xmurp-ua/record0、record1……（每个 CPU 一个，需要全部给出），也可以是 rkpGen、rkpReplay、rkpNfq 的 -R 写出的文件。
+// 读取 debugfs 中的文件会取走其中的记录，需要保留的话先复制出来：
+//      cat /sys/kernel/debug/xmurp-ua/record* > rec.bin && rkpRecord rec.bin
+// 所有记录按时间排序后按流分组。流的建立早于最早的记录时，不知道它的地址，-a 不会选中它。
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+struct rkpRecord
+// 与 src/rkpRecord.h 中的布局相同
+{
+    uint64_t time;
+    uint32_t flow, seq, map_begin;
+    uint16_t len, map_length;
+    uint8_t event, flags;
+    uint8_t status_before, status_after;
+    uint8_t scan_before, scan_after;
+    uint8_t verdict, n_map;
+};
+_Static_assert(sizeof(struct rkpRecord) == 32, "rkpRecord must be 32 bytes.");
+
+// 与 src/rkpRecord.h、src/rkpStream.h 中的枚举以及 src/rkpTrace.h 中的名称相同
+static const char* rkpRecord_event[] = {"execute", "new", "delete", "flush"};
+static const char* rkpRecord_status[] = {"sniffing_uaBegin", "sniffing_uaEnd", "waiting", "sniffing_headEnd", "body"};
+static const char* rkpRecord_scan[] = {"noFound", "uaBegin", "uaRealBegin", "uaEnd", "uaGood", "headEnd", "uaDone"};
+static const char* rkpRecord_verdict[] = {"NF_DROP", "NF_ACCEPT", "NF_STOLEN"};
+#define rkpRecord_name(table, i) ((i) < sizeof(table) / sizeof(table[0]) ? table[i] : "?")
+
+struct rkpRecord_flow
+// 一个流：记录的下标按时间排好，地址来自 new 事件
+{
+    uint32_t flow;
+    uint32_t client, server;
+    uint16_t cport, sport;
+    int known;
+    size_t* index;
+    size_t n, cap;
+};
+
+static struct rkpRecord* rkpRecord_records;
+static size_t rkpRecord_n;
+
+static int rkpRecord_load(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    struct rkpRecord r;
+    size_t cap = rkpRecord_n;
+    if(fp == 0)
+    {
+        perror(path);
+        return -1;
+    }
+    while(fread(&r, sizeof(r), 1, fp) == 1)
+    {
+        if(rkpRecord_n == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            rkpRecord_records = realloc(rkpRecord_records, cap * sizeof(struct rkpRecord));
+        }
+        rkpRecord_records[rkpRecord_n++] = r;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int rkpRecord_cmp(const void* a, const void* b)
+{
+    const struct rkpRecord *ra = a, *rb = b;
+    if(ra -> time != rb -> time)
+        return ra -> time < rb -> time ? -1 : 1;
+    return 0;
+}
+
+static void rkpRecord_addr(char* buff, uint32_t addr, uint16_t port)
+{
+    sprintf(buff, "%u.%u.%u.%u:%u", addr >> 24, (addr >> 16) & 0xFF, (addr >> 8) & 0xFF, addr & 0xFF, port);
+}
+
+static void rkpRecord_print(const struct rkpRecord* r, uint64_t begin)
+{
+    printf("  %12.6f ", (double)(r -> time - begin) / 1e9);
+    switch(r -> event)
+    {
+    case 0:
+        if(r -> flags & 1)
+            printf("ack %u", r -> seq);
+        else
+            printf("seq %u len %u%s", r -> seq, r -> len, r -> flags & 2 ? " psh" : "");
+        if(r -> status_before != r -> status_after)
+            printf(" status %s -> %s", rkpRecord_name(rkpRecord_status, r -> status_before), rkpRecord_name(rkpRecord_status, r -> status_after));
+        else
+            printf(" status %s", rkpRecord_name(rkpRecord_status, r -> status_after));
+        if(r -> scan_before != r -> scan_after)
+            printf(" scan %s -> %s", rkpRecord_name(rkpRecord_scan, r -> scan_before), rkpRecord_name(rkpRecord_scan, r -> scan_after));
+        printf(" %s", rkpRecord_name(rkpRecord_verdict, r -> verdict));
+        if(r -> n_map != 0)
+            printf(" map %u+%u", r -> map_begin, r -> map_length);
+        if(r -> n_map > 1)
+            printf(" (last of %u)", r -> n_map);
+        break;
+    case 3:
+        printf("flush %u packets", r -> n_map);
+        break;
+    default:
+        printf("%s", rkpRecord_name(rkpRecord_event, r -> event));
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    struct rkpRecord_flow* flows = 0;
+    size_t n_flow = 0, cap_flow = 0, i, j;
+    uint32_t only_flow = 0, only_addr = 0;
+    int has_flow = 0, has_addr = 0, opt;
+    while((opt = getopt(argc, argv, "f:a:")) != -1)
+        switch(opt)
+        {
+        case 'f':
+            only_flow = strtoul(optarg, 0, 16);
+            has_flow = 1;
+            break;
+        case 'a':
+        {
+            struct in_addr a;
+            if(inet_pton(AF_INET, optarg, &a) != 1)
+            {
+                fprintf(stderr, "bad address: %s\n", optarg);
+                return 1;
+            }
+            only_addr = ntohl(a.s_addr);
+            has_addr = 1;
+            break;
+        }
+        default:
+            fprintf(stderr, "usage: %s [-f flow] [-a address] file...\n", argv[0]);
+            return 1;
+        }
+    if(optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-f flow] [-a address] file...\n", argv[0]);
+        return 1;
+    }
+    for(i = optind; i < argc; i++)
+        if(rkpRecord_load(argv[i]) != 0)
+            return 1;
+    // 每个文件内部已经按时间排好，合并几个文件后需要重新排序。qsort 不稳定，但同一个流的记录总在一个 CPU 上按锁的顺序写入，时间不会相同
+    qsort(rkpRecord_records, rkpRecord_n, sizeof(struct rkpRecord), rkpRecord_cmp);
+
+    // 按流分组。从最新的流往前找，同一个流的记录通常挨在一起
+    for(i = 0; i < rkpRecord_n; i++)
+    {
+        const struct rkpRecord* r = &rkpRecord_records[i];
+        struct rkpRecord_flow* f = 0;
+        for(j = n_flow; j > 0; j--)
+            if(flows[j - 1].flow == r -> flow)
+            {
+                f = &flows[j - 1];
+                break;
+            }
+        // 流被删除以后，同一个哈希可能属于一个新的流
+        if(f == 0 || (r -> event == 1 && f -> n != 0))
+        {
+            if(n_flow == cap_flow)
+            {
+                cap_flow = cap_flow ? cap_flow * 2 : 256;
+                flows = realloc(flows, cap_flow * sizeof(struct rkpRecord_flow));
+            }
+            f = &flows[n_flow++];
+            memset(f, 0, sizeof(struct rkpRecord_flow));
+            f -> flow = r -> flow;
+        }
+        if(r -> event == 1)
+        {
+            f -> client = r -> seq;
+            f -> server = r -> map_begin;
+            f -> cport = r -> len;
+            f -> sport = r -> map_length;
+            f -> known = 1;
+        }
+        if(f -> n == f -> cap)
+        {
+            f -> cap = f -> cap ? f -> cap * 2 : 16;
+            f -> index = realloc(f -> index, f -> cap * sizeof(size_t));
+        }
+        f -> index[f -> n++] = i;
+    }
+
+    for(i = 0; i < n_flow; i++)
+    {
+        struct rkpRecord_flow* f = &flows[i];
+        char client[32], server[32];
+        if(has_flow && f -> flow != only_flow)
+            continue;
+        if(has_addr && !(f -> known && (f -> client == only_addr || f -> server == only_addr)))
+            continue;
+        if(f -> known)
+        {
+            rkpRecord_addr(client, f -> client, f -> cport);
+            rkpRecord_addr(server, f -> server, f -> sport);
+            printf("flow %08x %s -> %s\n", f -> flow, client, server);
+        }
+        else
+            printf("flow %08x (created before the first record)\n", f -> flow);
+        for(j = 0; j < f -> n; j++)
+            rkpRecord_print(&rkpRecord_records[f -> index[j]], rkpRecord_records[f -> index[0]].time);
+    }
+    printf("# %zu records, %zu flows\n", rkpRecord_n, n_flow);
+    return 0;
+}
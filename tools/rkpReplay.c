@@ -0,0 +1,350 @@
+// 读入一个 pcap 文件，按抓包的顺序把每个包交给 rkpManager 处理，统计性能，并将处理后的包写入另一个 pcap 文件以便比较。
+// 用法：rkpReplay [选项] 输入.pcap [输出.pcap]
+//      -r n        重复 n 遍，每一遍使用新的 rkpManager，用来让小的抓包也能得到稳定的结果
+//      -m          不使用 autocapture，而是给发往 80 端口的包打上 mark_capture，给来自 80 端口的 ACK 打上 mark_capture 和 mark_ack
+//      -s 字符串   同模块参数 str_preserve，可以指定多次
+//      -H 规则     同模块参数 str_rule，可以指定多次
+//      -l n        同模块参数 len_ua
+//      -b n        同模块参数 mem_budget
+//      -L          同模块参数 stateless
+//      -p          同模块参数 profile，最后输出各个阶段的累计耗时
+//      -R 文件     飞行记录器的记录写到这个文件，用 rkpRecord 解码
+#include "rkpLib.h"
+#include <unistd.h>
+
+struct rkpReplay_packet
+// 读入的一个包。skb 的 data 指向 frame 中 IP 头的位置
+{
+    u32 ts_sec, ts_frac;
+    unsigned len_frame, off_ip;
+    unsigned char* frame;
+    struct sk_buff skb;
+};
+
+static struct rkpReplay_packet* rkpReplay_packets;
+static unsigned rkpReplay_n;
+static u32 rkpReplay_linktype, rkpReplay_magic;
+static FILE* rkpReplay_out;
+static _Bool rkpReplay_mark = 0;
+static struct rkpLib_config rkpReplay_cfg;
+static unsigned long rkpReplay_n_written, rkpReplay_n_freed;
+
+static u32 rkpReplay_swap32(u32 x, _Bool swap) { return swap ? __builtin_bswap32(x) : x; }
+static u64 rkpReplay_time(const struct rkpReplay_packet* p)
+// 抓包的时间，单位为纳秒。magic 为 0xA1B23C4D 时 ts_frac 是纳秒，否则是微秒
+{
+    return (u64)p -> ts_sec * 1000000000 + (u64)p -> ts_frac * (rkpReplay_magic == 0xA1B23C4D ? 1 : 1000);
+}
+
+int rkpReplay_offset(const unsigned char* frame, unsigned len)
+// 根据链路层类型找到 IPv4 头的位置，不是 IPv4 时返回 -1
+{
+    unsigned off;
+    u16 proto;
+    switch(rkpReplay_linktype)
+    {
+    case 1:                                     // Ethernet，允许最多两层 VLAN
+        for(off = 12; off + 2 <= len; off += 4)
+        {
+            proto = (frame[off] << 8) | frame[off + 1];
+            if(proto != 0x8100 && proto != 0x88A8)
+                break;
+        }
+        if(off + 2 > len || proto != 0x0800)
+            return -1;
+        return off + 2;
+    case 113:                                   // Linux cooked capture
+        if(len < 16 || ((frame[14] << 8) | frame[15]) != 0x0800)
+            return -1;
+        return 16;
+    case 101:                                   // raw IP
+    case 228:                                   // raw IPv4
+        if(len < 1 || (frame[0] >> 4) != 4)
+            return -1;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int rkpReplay_load(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    u32 hdr[6], rec[4];
+    _Bool swap;
+    unsigned cap = 1024;
+    if(fp == 0)
+    {
+        perror(path);
+        return -1;
+    }
+    if(fread(hdr, 4, 6, fp) != 6)
+    {
+        fprintf(stderr, "%s: not a pcap file.\n", path);
+        fclose(fp);
+        return -1;
+    }
+    if(hdr[0] == 0xA1B2C3D4 || hdr[0] == 0xA1B23C4D)
+        swap = false;
+    else if(hdr[0] == 0xD4C3B2A1 || hdr[0] == 0x4D3CB2A1)
+        swap = true;
+    else
+    {
+        fprintf(stderr, "%s: not a pcap file (pcapng is not supported).\n", path);
+        fclose(fp);
+        return -1;
+    }
+    rkpReplay_magic = rkpReplay_swap32(hdr[0], swap);
+    rkpReplay_linktype = rkpReplay_swap32(hdr[5], swap) & 0x0FFFFFFF;
+
+    rkpReplay_packets = malloc(sizeof(struct rkpReplay_packet) * cap);
+    while(fread(rec, 4, 4, fp) == 4)
+    {
+        struct rkpReplay_packet* p;
+        if(rkpReplay_n == cap)
+        {
+            cap *= 2;
+            rkpReplay_packets = realloc(rkpReplay_packets, sizeof(struct rkpReplay_packet) * cap);
+        }
+        p = &rkpReplay_packets[rkpReplay_n];
+        p -> ts_sec = rkpReplay_swap32(rec[0], swap);
+        p -> ts_frac = rkpReplay_swap32(rec[1], swap);
+        p -> len_frame = rkpReplay_swap32(rec[2], swap);
+        p -> frame = malloc(p -> len_frame);
+        if(fread(p -> frame, 1, p -> len_frame, fp) != p -> len_frame)
+        {
+            free(p -> frame);
+            break;
+        }
+        // 只把完整的、带有 TCP 头的 IPv4 包交给 rkpManager，其它的原样写出
+        p -> off_ip = (unsigned)-1;
+        if(rkpReplay_swap32(rec[3], swap) == p -> len_frame)
+        {
+            int off = rkpReplay_offset(p -> frame, p -> len_frame);
+            if(off >= 0 && p -> len_frame >= off + 20)
+            {
+                const struct iphdr* iph = (const struct iphdr*)(p -> frame + off);
+                if(iph -> ihl >= 5 && ntohs(iph -> tot_len) <= p -> len_frame - off && ntohs(iph -> tot_len) >= iph -> ihl * 4
+                        && (iph -> protocol != IPPROTO_TCP || ntohs(iph -> tot_len) >= iph -> ihl * 4 + 20))
+                    p -> off_ip = off;
+            }
+        }
+        rkpReplay_n++;
+    }
+    fclose(fp);
+    return 0;
+}
+
+void rkpReplay_write(const struct rkpReplay_packet* p, const unsigned char* frame)
+{
+    u32 rec[4] = {p -> ts_sec, p -> ts_frac, p -> len_frame, p -> len_frame};
+    rkpReplay_n_written++;
+    if(rkpReplay_out == 0)
+        return;
+    fwrite(rec, 4, 4, rkpReplay_out);
+    fwrite(frame, 1, p -> len_frame, rkpReplay_out);
+}
+
+static void rkpReplay_xmit(struct sk_buff* skb)
+{
+    const struct rkpReplay_packet* p = skb -> priv;
+    rkpReplay_write(p, skb -> data - p -> off_ip);
+}
+static void rkpReplay_free(struct sk_buff* skb)
+{
+    rkpReplay_n_freed++;
+}
+
+void rkpReplay_prepare(struct rkpReplay_packet* p, unsigned char* frame)
+// 在 frame 上构造 skb。每一遍都用一份新的拷贝，因为 rkpManager 会修改包的内容
+{
+    memcpy(frame, p -> frame, p -> len_frame);
+    p -> skb.data = frame + p -> off_ip;
+    p -> skb.len = ntohs(((struct iphdr*)p -> skb.data) -> tot_len);
+    p -> skb.truesize = ksize(frame) + sizeof(struct sk_buff);
+    p -> skb.mark = 0;
+    p -> skb.priv = p;
+    if(rkpReplay_mark && ip_hdr(&p -> skb) -> protocol == IPPROTO_TCP)
+    {
+        if(ntohs(tcp_hdr(&p -> skb) -> dest) == 80)
+            p -> skb.mark = rkpReplay_cfg.mark_capture;
+        else if(ntohs(tcp_hdr(&p -> skb) -> source) == 80 && tcp_hdr(&p -> skb) -> ack)
+            p -> skb.mark = rkpReplay_cfg.mark_capture | rkpReplay_cfg.mark_ack;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static const char* preserve[128];
+    static const char* rule[15];
+    unsigned n_preserve = 0, n_rule = 0, repeat = 1, r, i;
+    int opt;
+    const char* verdict_name[3] = {"drop", "accept", "stolen"};
+    unsigned long n_verdict[3] = {0}, n_passed = 0;
+    u64 ns_verdict[3] = {0}, ns_max[3] = {0}, ns_total = 0;
+    long peak_mem = 0, peak_held = 0, peak_bytes = 0, peak_flows = 0;
+    struct rkpLib_stat st;
+    unsigned char** frames;
+
+    rkpLib_defaultConfig(&rkpReplay_cfg);
+    while((opt = getopt(argc, argv, "r:ms:H:l:b:LpR:")) != -1)
+        switch(opt)
+        {
+        case 'r':
+            repeat = strtoul(optarg, 0, 0);
+            break;
+        case 'm':
+            rkpReplay_mark = 1;
+            rkpReplay_cfg.autocapture = false;
+            break;
+        case 's':
+            if(n_preserve < 128)
+                preserve[n_preserve++] = optarg;
+            break;
+        case 'H':
+            if(n_rule < 15)
+                rule[n_rule++] = optarg;
+            break;
+        case 'l':
+            rkpReplay_cfg.len_ua = strtoul(optarg, 0, 0);
+            break;
+        case 'b':
+            rkpReplay_cfg.mem_budget = strtoul(optarg, 0, 0);
+            break;
+        case 'L':
+            rkpReplay_cfg.stateless = true;
+            break;
+        case 'p':
+            rkpReplay_cfg.profile = true;
+            break;
+        case 'R':
+            rkpReplay_cfg.record = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r repeat] [-m] [-s preserve]... [-H rule]... [-l len_ua] [-b mem_budget] [-L] [-p] [-R record] in.pcap [out.pcap]\n", argv[0]);
+            return 1;
+        }
+    if(optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-r repeat] [-m] [-s preserve]... [-H rule]... [-l len_ua] [-b mem_budget] [-L] [-p] [-R record] in.pcap [out.pcap]\n", argv[0]);
+        return 1;
+    }
+    rkpReplay_cfg.str_preserve = preserve;
+    rkpReplay_cfg.n_str_preserve = n_preserve;
+    rkpReplay_cfg.str_rule = rule;
+    rkpReplay_cfg.n_str_rule = n_rule;
+    if(rkpReplay_load(argv[optind]) != 0)
+        return 1;
+    if(rkpLib_init(&rkpReplay_cfg) != 0)
+        return 1;
+    rkpLib_xmit = rkpReplay_xmit;
+    rkpLib_free = rkpReplay_free;
+
+    // 只有最后一遍的结果写入文件
+    frames = malloc(sizeof(unsigned char*) * rkpReplay_n);
+    for(i = 0; i < rkpReplay_n; i++)
+        frames[i] = malloc(rkpReplay_packets[i].len_frame);
+    for(r = 0; r < repeat; r++)
+    {
+        struct rkpManager* rkpm;
+        u64 now = rkpReplay_n ? rkpReplay_time(&rkpReplay_packets[0]) : 0;
+        // 时间（jiffies 和 ktime_get_ns）跟着抓包的时间走，这样 time_keepalive、time_hold 等和时间有关的逻辑与实际一致。
+        // rkpManager 在第一个包的时间创建，它的定时器从这时开始计时
+        rkpLib_setClock(now);
+        rkpm = rkpLib_manager_new();
+        if(rkpm == 0)
+        {
+            fprintf(stderr, "rkpManager_new failed.\n");
+            return 1;
+        }
+        if(r + 1 == repeat && optind + 1 < argc)
+        {
+            u32 hdr[6] = {rkpReplay_magic, 0x00040002, 0, 0, 0x40000, rkpReplay_linktype};
+            rkpReplay_out = fopen(argv[optind + 1], "wb");
+            if(rkpReplay_out == 0)
+            {
+                perror(argv[optind + 1]);
+                return 1;
+            }
+            fwrite(hdr, 4, 6, rkpReplay_out);
+        }
+        for(i = 0; i < rkpReplay_n; i++)
+        {
+            struct rkpReplay_packet* p = &rkpReplay_packets[i];
+            unsigned rtn;
+            u64 t;
+            if(p -> off_ip == (unsigned)-1)
+            {
+                n_passed++;
+                rkpReplay_write(p, p -> frame);
+                continue;
+            }
+            // 抓包的时间可能因为乱序而回退，时间不能倒流。每个包之前都像内核中那样触发到期的定时器
+            if(rkpReplay_time(p) > now)
+                now = rkpReplay_time(p);
+            rkpLib_setClock(now);
+            rkpLib_refresh(rkpm);
+            rkpReplay_prepare(p, frames[i]);
+            t = rkpShim_monotonic();
+            rtn = rkpLib_execute(rkpm, &p -> skb);
+            t = rkpShim_monotonic() - t;
+            ns_total += t;
+            n_verdict[rtn]++;
+            ns_verdict[rtn] += t;
+            if(t > ns_max[rtn])
+                ns_max[rtn] = t;
+            if(rtn == NF_ACCEPT)
+                rkpReplay_write(p, frames[i]);
+            else if(rtn == NF_DROP)
+                rkpReplay_n_freed++;
+            rkpLib_stat(rkpm, &st);
+            if(st.mem_used > peak_mem)
+                peak_mem = st.mem_used;
+            if(st.packets_held > peak_held)
+                peak_held = st.packets_held;
+            if(st.bytes_held > peak_bytes)
+                peak_bytes = st.bytes_held;
+            if(st.flows > peak_flows)
+                peak_flows = st.flows;
+        }
+        // 抓包结束后再等 time_hold，让截留的包像在内核中那样超时放出；之后仍然截留的包会被丢弃，计入 freed
+        rkpLib_setClock(now + (u64)rkpReplay_cfg.time_hold * 1000000);
+        rkpLib_refresh(rkpm);
+        rkpLib_manager_delete(rkpm);
+    }
+    if(rkpReplay_out != 0)
+        fclose(rkpReplay_out);
+
+    // 这时 rkpManager 都已经删除，它们的计数都并到了当前线程中
+    rkpLib_stat(0, &st);
+    printf("packets: %u x %u\n", rkpReplay_n, repeat);
+    printf("packets_passed: %lu\n", n_passed);
+    printf("time_ns: %llu\n", (unsigned long long)ns_total);
+    printf("packets_per_sec: %.0f\n", ns_total ? (double)(n_verdict[0] + n_verdict[1] + n_verdict[2]) * 1e9 / ns_total : 0);
+    for(i = 0; i < 3; i++)
+        printf("%s: %lu avg_ns %.1f max_ns %llu\n", verdict_name[i], n_verdict[i],
+                n_verdict[i] ? (double)ns_verdict[i] / n_verdict[i] : 0, (unsigned long long)ns_max[i]);
+    printf("ua_rewritten: %lu\n", st.ua_rewritten);
+    printf("ua_preserved: %lu\n", st.ua_preserved);
+    printf("rule_rewritten: %lu\n", st.rule_rewritten);
+    printf("rule_preserved: %lu\n", st.rule_preserved);
+    printf("disordered: %lu\n", st.disordered);
+    printf("retransmit: %lu\n", st.retransmit);
+    printf("lenUa_overflow: %lu\n", st.lenUa_overflow);
+    printf("budget_bypass: %lu\n", st.budget_bypass);
+    printf("budget_flush: %lu\n", st.budget_flush);
+    printf("stateless_handled: %lu\n", st.stateless_handled);
+    printf("stateless_promoted: %lu\n", st.stateless_promoted);
+    printf("stateless_demoted: %lu\n", st.stateless_demoted);
+    printf("stateless_evicted: %lu\n", st.stateless_evicted);
+    printf("peak_mem_used: %ld\n", peak_mem);
+    printf("peak_packets_held: %ld\n", peak_held);
+    printf("peak_bytes_held: %ld\n", peak_bytes);
+    printf("peak_flows: %ld\n", peak_flows);
+    printf("packets_written: %lu\n", rkpReplay_n_written);
+    printf("packets_freed: %lu\n", rkpReplay_n_freed);
+    if(rkpReplay_cfg.profile)
+        rkpLib_profile(stdout);
+    rkpLib_exit();
+    return 0;
+}
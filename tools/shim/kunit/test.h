@@ -0,0 +1,29 @@
+#pragma once
+#include "../rkpShim.h"
+// KUnit，只实现了 src/rkpTest.h 用到的部分。用例由 rkpLib_test 依次直接调用，失败时不会中止用例
+struct kunit
+{
+    const char* name;
+    bool failed;
+    FILE* log;
+};
+struct kunit_case
+{
+    void (*run_case)(struct kunit*);
+    const char* name;
+};
+struct kunit_suite
+{
+    const char* name;
+    int (*init)(struct kunit*);
+    void (*exit)(struct kunit*);
+    struct kunit_case* test_cases;
+};
+#define KUNIT_CASE(f) {.run_case = f, .name = #f}
+#define kunit_info(test, fmt, ...) fprintf((test) -> log, "    # %s: " fmt, (test) -> name, ##__VA_ARGS__)
+#define KUNIT_FAIL(test, fmt, ...) \
+    ((test) -> failed = true, fprintf((test) -> log, "    # %s: %s:%d: " fmt "\n", (test) -> name, __FILE__, __LINE__, ##__VA_ARGS__))
+#define KUNIT_EXPECT_TRUE(test, cond) ((cond) ? (void)0 : (void)KUNIT_FAIL(test, "expected %s", #cond))
+#define KUNIT_EXPECT_EQ(test, left, right) KUNIT_EXPECT_TRUE(test, (left) == (right))
+#define KUNIT_EXPECT_EQ_MSG(test, left, right, fmt, ...) \
+    (((left) == (right)) ? (void)0 : (void)KUNIT_FAIL(test, "expected %s == %s, " fmt, #left, #right, ##__VA_ARGS__))
@@ -0,0 +1,313 @@
+// 在用户态编译 src 下的头文件所需的最小的内核接口。
+// tools/shim 放在头文件搜索路径的最前面，src/common.h 包含的 <linux/...> 等头文件都会被替换成这里的同名文件，而它们只是包含这个文件。
+// 只求能让 rkpPacket、rkpMap、rkpStream、rkpManager 原样编译和运行，不追求和内核的行为完全一致：
+//      * 没有真正的锁，一个 rkpManager 只能同时被一个线程使用，rkpManager 也只能在一个线程中创建和删除。不同的线程可以各自使用自己的 rkpManager
+//      * 每个 CPU 一份的变量变成每个线程一份，求和时只能得到当前线程的值
+//      * 定时器不会自己触发，jiffies 由使用者推进，rkpLib_refresh 检查是否到期。回放抓包时 ktime_get_ns 也由使用者设置（见 rkpLib_setClock）
+#pragma once
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <malloc.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#define true 1
+#define false 0
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef uint32_t __wsum;
+typedef uint16_t __sum16;
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(5, 10, 0)
+
+#define __init
+#define __exit
+#define module_param(name, type, perm)
+#define module_param_array(name, type, nump, perm)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_LICENSE(x)
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+
+#define container_of(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define ALIGN(x, a) (((x) + (a) - 1) / (a) * (a))
+
+// 内存
+#define GFP_KERNEL 0
+#define GFP_ATOMIC 0
+#define GFP_NOWAIT 0
+static inline void* kmalloc(size_t size, int flags) { return malloc(size); }
+static inline void kfree(const void* p) { free((void*)p); }
+static inline size_t ksize(const void* p) { return malloc_usable_size((void*)p); }
+static inline char* kstrdup(const char* s, int flags) { return strdup(s); }
+static inline void* vzalloc(size_t size) { return calloc(1, size); }
+static inline void vfree(const void* p) { free((void*)p); }
+#define SMP_CACHE_BYTES 64
+
+// 时间
+#define HZ 1000
+extern unsigned long rkpShim_jiffies;
+extern u64 rkpShim_clock;                       // 不为 0 时 ktime_get_ns 返回它而不是单调时钟，由 rkpLib_setClock 设置
+#define jiffies __atomic_load_n(&rkpShim_jiffies, __ATOMIC_RELAXED)
+static inline unsigned jiffies_to_msecs(unsigned long j) { return j * 1000 / HZ; }
+static inline u64 rkpShim_monotonic(void)       // 总是返回单调时钟，用来测量耗时
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static inline u64 ktime_get_ns(void)
+{
+    return rkpShim_clock != 0 ? rkpShim_clock : rkpShim_monotonic();
+}
+// 周期计数器，x86 以外用纳秒代替
+typedef u64 cycles_t;
+static inline cycles_t get_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return rkpShim_monotonic();
+#endif
+}
+
+// 位运算
+static inline int fls64(u64 x) { return x == 0 ? 0 : 64 - __builtin_clzll(x); }
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+static inline u64 div64_u64(u64 a, u64 b) { return a / b; }
+
+// 调度
+#define cond_resched() ((void)0)
+
+// seq_file，直接写到文件
+struct seq_file
+{
+    FILE* fp;
+};
+#define seq_printf(m, ...) fprintf((m) -> fp, __VA_ARGS__)
+
+// 锁
+typedef int spinlock_t;
+#define spin_lock_init(lock) ((void)(lock))
+#define spin_lock_irqsave(lock, flags) ((void)(lock), (flags) = 0)
+#define spin_unlock_irqrestore(lock, flags) ((void)(lock), (void)(flags))
+#define DEFINE_MUTEX(name) int name
+#define mutex_lock(m) ((void)(m))
+#define mutex_unlock(m) ((void)(m))
+static inline int mutex_trylock(int* m) { return 1; }
+
+// 链表
+struct list_head
+{
+    struct list_head *next, *prev;
+};
+#define LIST_HEAD(name) struct list_head name = {&(name), &(name)}
+static inline void INIT_LIST_HEAD(struct list_head* head) { head -> next = head -> prev = head; }
+static inline int list_empty(const struct list_head* head) { return head -> next == head; }
+#define list_first_entry(head, type, member) container_of((head) -> next, type, member)
+static inline void list_add_tail(struct list_head* entry, struct list_head* head)
+{
+    entry -> prev = head -> prev;
+    entry -> next = head;
+    head -> prev -> next = entry;
+    head -> prev = entry;
+}
+static inline void list_del(struct list_head* entry)
+{
+    entry -> prev -> next = entry -> next;
+    entry -> next -> prev = entry -> prev;
+}
+static inline void list_del_init(struct list_head* entry)
+{
+    list_del(entry);
+    INIT_LIST_HEAD(entry);
+}
+#define list_for_each_entry(pos, head, member)                                          \
+    for(pos = container_of((head) -> next, typeof(*pos), member); &pos -> member != (head);  \
+        pos = container_of(pos -> member.next, typeof(*pos), member))
+#define list_for_each_entry_safe(pos, n, head, member)                                  \
+    for(pos = container_of((head) -> next, typeof(*pos), member),                        \
+        n = container_of(pos -> member.next, typeof(*pos), member); &pos -> member != (head);   \
+        pos = n, n = container_of(n -> member.next, typeof(*n), member))
+
+// 定时器
+struct timer_list
+{
+    void (*function)(struct timer_list*);
+    unsigned long expires;
+};
+#define timer_setup(timer, fn, flags) ((timer) -> function = (fn))
+#define add_timer(timer) ((void)(timer))
+#define del_timer_sync(timer) ((void)(timer))
+#define from_timer(var, timer, field) container_of(timer, typeof(*var), field)
+
+// 高精度定时器，同样不会自己触发，由使用者检查 expires 后调用 function
+typedef s64 ktime_t;
+#define NSEC_PER_MSEC 1000000ULL
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum hrtimer_mode { HRTIMER_MODE_ABS, HRTIMER_MODE_ABS_SOFT };
+struct hrtimer
+{
+    enum hrtimer_restart (*function)(struct hrtimer*);
+    ktime_t expires;
+    int queued;
+};
+static inline ktime_t ns_to_ktime(u64 ns) { return ns; }
+static inline void hrtimer_init(struct hrtimer* t, clockid_t clock, enum hrtimer_mode mode) { t -> queued = 0; }
+static inline void hrtimer_start(struct hrtimer* t, ktime_t expires, enum hrtimer_mode mode) { t -> expires = expires; t -> queued = 1; }
+static inline int hrtimer_cancel(struct hrtimer* t) { int rtn = t -> queued; t -> queued = 0; return rtn; }
+static inline int hrtimer_is_queued(const struct hrtimer* t) { return t -> queued; }
+
+// 每个 CPU 一份的变量
+#define DEFINE_PER_CPU(type, name) __thread type name
+#define this_cpu_inc(x) ((x)++)
+#define this_cpu_add(x, n) ((x) += (n))
+#define this_cpu_sub(x, n) ((x) -= (n))
+#define this_cpu_read(x) (x)
+#define this_cpu_write(x, v) ((x) = (v))
+#define for_each_possible_cpu(cpu) for((cpu) = 0; (cpu) < 1; (cpu)++)
+#define per_cpu_ptr(ptr, cpu) (ptr)
+// 动态分配的每个 CPU 一份的变量，每个线程当作一个 CPU，第一次用到时分到一个编号
+#define rkpShim_nCpu 64
+#define __percpu
+int rkpShim_cpu(void);
+#define alloc_percpu(type) ((type*)calloc(rkpShim_nCpu, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define this_cpu_ptr(ptr) ((ptr) + rkpShim_cpu())
+#define smp_processor_id() rkpShim_cpu()
+#define nr_cpu_ids rkpShim_nCpu
+#define on_each_cpu(func, info, wait) ((func)(info))       // 只有当前线程这一个“CPU”
+struct percpu_counter
+{
+    s64 count;
+};
+static inline int percpu_counter_init(struct percpu_counter* c, s64 v, int gfp) { c -> count = v; return 0; }
+static inline void percpu_counter_destroy(struct percpu_counter* c) {}
+// 所有线程共用一个，用原子操作
+static inline void percpu_counter_add_batch(struct percpu_counter* c, s64 n, s64 batch) { __atomic_add_fetch(&c -> count, n, __ATOMIC_RELAXED); }
+static inline s64 percpu_counter_sum(struct percpu_counter* c) { return __atomic_load_n(&c -> count, __ATOMIC_RELAXED); }
+static inline s64 percpu_counter_read_positive(struct percpu_counter* c) { s64 v = percpu_counter_sum(c); return v > 0 ? v : 0; }
+
+// static key
+struct static_key_false
+{
+    int enabled;
+};
+#define DEFINE_STATIC_KEY_FALSE(name) struct static_key_false name = {0}
+#define static_branch_unlikely(key) ((key) -> enabled)
+#define static_branch_enable(key) ((key) -> enabled = 1)
+#define static_branch_disable(key) ((key) -> enabled = 0)
+
+// 跟踪点，全部变成空函数
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(class, name, proto, args) static inline void trace_##name(proto) {}
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) static inline void trace_##name(proto) {}
+
+// relay，飞行记录器的记录直接写到文件
+#define CONFIG_RELAY
+struct rchan
+{
+    FILE* fp;
+};
+static inline void relay_write(struct rchan* chan, const void* data, size_t length) { fwrite(data, length, 1, chan -> fp); }
+
+// netfilter
+#define NF_DROP 0
+#define NF_ACCEPT 1
+#define NF_STOLEN 2
+
+// sk_buff。data 指向 IP 头，和 IPv4 的 netfilter 钩子中一样
+struct sk_buff
+{
+    unsigned char* data;
+    unsigned len, truesize;
+    u32 mark;
+    __wsum csum;
+    void* priv;                                 // 留给使用者
+};
+static inline struct iphdr* ip_hdr(const struct sk_buff* skb) { return (struct iphdr*)skb -> data; }
+static inline struct tcphdr* tcp_hdr(const struct sk_buff* skb) { return (struct tcphdr*)(skb -> data + ip_hdr(skb) -> ihl * 4); }
+static inline int skb_ensure_writable(struct sk_buff* skb, unsigned len) { return len <= skb -> len ? 0 : -ENOMEM; }
+
+// 发出和释放截留的包时回调使用者
+extern void (*rkpShim_xmit)(struct sk_buff*);
+extern void (*rkpShim_free)(struct sk_buff*);
+static inline int dev_queue_xmit(struct sk_buff* skb) { rkpShim_xmit(skb); return 0; }
+static inline void kfree_skb(struct sk_buff* skb) { rkpShim_free(skb); }
+
+// 模块自己构造的 skb（只有 rkpTest 用到），与上面由使用者提供的 skb 分开释放
+static inline struct sk_buff* alloc_skb(unsigned size, int flags)
+{
+    struct sk_buff* skb = calloc(1, sizeof(struct sk_buff) + size);
+    if(skb == 0)
+        return 0;
+    skb -> data = (unsigned char*)(skb + 1);
+    skb -> truesize = sizeof(struct sk_buff) + size;
+    return skb;
+}
+static inline void* skb_put(struct sk_buff* skb, unsigned len)
+{
+    void* p = skb -> data + skb -> len;
+    skb -> len += len;
+    return p;
+}
+#define skb_reset_network_header(skb) ((void)(skb))
+#define skb_set_transport_header(skb, offset) ((void)(skb))
+static inline void consume_skb(struct sk_buff* skb) { free(skb); }
+
+// 校验和，与内核一样按内存中的顺序读 16 位的字相加
+static inline u32 rkpShim_csum_add(const unsigned char* p, unsigned len, u64 sum)
+{
+    unsigned i;
+    for(i = 0; i + 1 < len; i += 2)
+        sum += *(const u16*)(p + i);
+    if(len & 1)
+    {
+        u16 last = 0;
+        *(unsigned char*)&last = p[len - 1];
+        sum += last;
+    }
+    while(sum >> 32)
+        sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    return sum;
+}
+static inline u16 rkpShim_csum_fold(u32 sum)
+{
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum;
+}
+static inline __wsum skb_checksum(const struct sk_buff* skb, int offset, int len, __wsum csum)
+{
+    return rkpShim_csum_add(skb -> data + offset, len, csum);
+}
+static inline __sum16 ip_fast_csum(const void* iph, unsigned ihl)
+{
+    return rkpShim_csum_fold(rkpShim_csum_add(iph, ihl * 4, 0));
+}
+static inline __sum16 csum_tcpudp_magic(u32 saddr, u32 daddr, u32 len, u8 proto, __wsum sum)
+{
+    u16 pseudo[2] = {htons(proto), htons(len)};
+    u64 s = sum;
+    s = rkpShim_csum_add((const unsigned char*)&saddr, 4, s);
+    s = rkpShim_csum_add((const unsigned char*)&daddr, 4, s);
+    s = rkpShim_csum_add((const unsigned char*)pseudo, 4, s);
+    return rkpShim_csum_fold(s);
+}
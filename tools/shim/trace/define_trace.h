@@ -0,0 +1 @@
+// 跟踪点在用户态都是空函数，不需要再展开